@@ -10,6 +10,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "pz_code.h"
 #include "pz_data.h"
@@ -28,9 +29,16 @@ namespace pz {
 PZ::PZ(const Options &options) :
         m_options(options),
         m_entry_module(nullptr),
-        m_heap(new Heap(options, *this))
+        m_heap(new Heap(options, *this)),
+        m_stdout(new OutputBuffer(STDOUT_FILENO,
+                    options.stdout_buffer_size()))
 {
     set_heap(heap());
+
+    if (options.alloc_profile()) {
+        m_alloc_profile.reset(
+                new AllocProfile(options.alloc_profile_interval()));
+    }
 }
 
 PZ::~PZ() {
@@ -50,6 +58,12 @@ PZ::init()
 bool
 PZ::finalise()
 {
+    m_stdout->flush();
+
+    if (m_alloc_profile) {
+        m_alloc_profile->report(stderr, 20);
+    }
+
     return heap()->finalise();
 }
 
@@ -81,6 +95,18 @@ PZ::lookup_module(const std::string &name)
     }
 }
 
+bool
+PZ::start_loading_module(const std::string &name)
+{
+    return m_modules_loading.insert(name).second;
+}
+
+void
+PZ::finish_loading_module(const std::string &name)
+{
+    m_modules_loading.erase(name);
+}
+
 void
 PZ::add_entry_module(Module *module)
 {
@@ -14,10 +14,13 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 
+#include "pz_alloc_profile.h"
 #include "pz_gc.h"
 
 #include "pz_module.h"
+#include "pz_output.h"
 
 namespace pz {
 
@@ -28,8 +31,13 @@ class PZ : public AbstractGCTracer {
   private:
     const Options                            &m_options;
     std::unordered_map<std::string, Module*>  m_modules;
+    // Modules that are being read, to detect circular imports.
+    std::unordered_set<std::string>           m_modules_loading;
+    SymbolTable                               m_symbols;
     std::unique_ptr<Module>                   m_entry_module;
     std::unique_ptr<Heap>                     m_heap;
+    std::unique_ptr<AllocProfile>             m_alloc_profile;
+    std::unique_ptr<OutputBuffer>             m_stdout;
 
   public:
     explicit PZ(const Options &options);
@@ -38,8 +46,22 @@ class PZ : public AbstractGCTracer {
     bool init();
     bool finalise();
 
+    const Options & options() const { return m_options; }
+
     Heap * heap() { return m_heap.get(); }
 
+    /*
+     * Non-null if allocation profiling is enabled.
+     */
+    AllocProfile * alloc_profile() { return m_alloc_profile.get(); }
+
+    /*
+     * The buffer for the program's standard output.
+     */
+    OutputBuffer & stdout_buffer() { return *m_stdout; }
+
+    SymbolTable & symbols() { return m_symbols; }
+
     Module * new_module(const std::string &name);
 
     /*
@@ -54,6 +76,12 @@ class PZ : public AbstractGCTracer {
 
     Module * lookup_module(const std::string &name);
 
+    /*
+     * Note that a module is being read, returns false if it already is.
+     */
+    bool start_loading_module(const std::string &name);
+    void finish_loading_module(const std::string &name);
+
     void add_entry_module(Module *module);
 
     Module * entry_module() const { return m_entry_module.get(); }
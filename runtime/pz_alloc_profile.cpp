@@ -0,0 +1,99 @@
+/*
+ * Plasma allocation site profiler
+ * vim: ts=4 sw=4 et
+ *
+ * Copyright (C) 2019 Plasma Team
+ * Distributed under the terms of the MIT license, see ../LICENSE.code
+ */
+
+#include "pz_common.h"
+
+#include <algorithm>
+
+#include "pz_alloc_profile.h"
+
+namespace pz {
+
+void
+AllocProfile::add_proc(const std::string &name, const uint8_t *code,
+        unsigned size)
+{
+    m_procs.push_back({code, size, name});
+}
+
+void
+AllocProfile::record_sample(const void *site, const char *what,
+        size_t bytes)
+{
+    Site &entry = m_sites[SiteKey(site, what)];
+
+    if (m_sample_interval == 0) {
+        entry.samples++;
+        entry.bytes += bytes;
+        entry.objects += 1.0;
+        return;
+    }
+
+    /*
+     * A large allocation may cross more than one sample boundary, each
+     * boundary it crosses counts as a sample.
+     */
+    size_t over = bytes - m_bytes_until_sample;
+    uint64_t samples = 1 + over / m_sample_interval;
+    m_bytes_until_sample = m_sample_interval - over % m_sample_interval;
+
+    entry.samples += samples;
+    entry.bytes += samples * m_sample_interval;
+    entry.objects += double(samples * m_sample_interval) / bytes;
+}
+
+std::string
+AllocProfile::site_name(const void *site) const
+{
+    const uint8_t *addr = static_cast<const uint8_t*>(site);
+    char buffer[32];
+
+    for (const ProcInfo &proc : m_procs) {
+        if (addr >= proc.code && addr < proc.code + proc.size) {
+            snprintf(buffer, sizeof(buffer), "+0x%x",
+                    unsigned(addr - proc.code));
+            return proc.name + buffer;
+        }
+    }
+
+    snprintf(buffer, sizeof(buffer), "%p", site);
+    return buffer;
+}
+
+void
+AllocProfile::report(FILE *stream, unsigned max_sites) const
+{
+    std::vector<std::pair<SiteKey, Site>> sites(m_sites.begin(),
+            m_sites.end());
+    std::sort(sites.begin(), sites.end(),
+            [](const std::pair<SiteKey, Site> &a,
+               const std::pair<SiteKey, Site> &b) {
+                return a.second.bytes > b.second.bytes;
+            });
+
+    if (m_sample_interval) {
+        fprintf(stream, "Allocation profile, sampled every %zu bytes:\n",
+                m_sample_interval);
+    } else {
+        fprintf(stream, "Allocation profile:\n");
+    }
+    fprintf(stream, "%12s %10s %8s  %-14s %s\n",
+            "bytes", "objects", "samples", "kind", "site");
+
+    unsigned num_sites = std::min<size_t>(sites.size(), max_sites);
+    for (unsigned i = 0; i < num_sites; i++) {
+        const SiteKey &key = sites[i].first;
+        const Site    &site = sites[i].second;
+
+        fprintf(stream, "%12" PRIu64 " %10.0f %8" PRIu64 "  %-14s %s\n",
+                site.bytes, site.objects, site.samples, key.second,
+                site_name(key.first).c_str());
+    }
+}
+
+} // namespace pz
@@ -0,0 +1,92 @@
+/*
+ * Plasma allocation site profiler
+ * vim: ts=4 sw=4 et
+ *
+ * Copyright (C) 2019 Plasma Team
+ * Distributed under the terms of the MIT license, see ../LICENSE.code
+ */
+
+#ifndef PZ_ALLOC_PROFILE_H
+#define PZ_ALLOC_PROFILE_H
+
+#include <stdio.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace pz {
+
+/*
+ * Count the allocations made by each allocation site.
+ *
+ * A site is the code address of the allocating instruction, or for
+ * builtins the address that the builtin will return to, paired with a
+ * short static string saying what was allocated.
+ *
+ * To keep the overhead low allocations are sampled, each time
+ * sample_interval bytes have been allocated the allocation that crossed
+ * the boundary is recorded and stands for the whole interval.  A
+ * sample_interval of zero records every allocation exactly.
+ */
+class AllocProfile {
+  private:
+    struct Site {
+        uint64_t    samples;
+        uint64_t    bytes;
+        double      objects;
+
+        Site() : samples(0), bytes(0), objects(0.0) {}
+    };
+
+    struct ProcInfo {
+        const uint8_t  *code;
+        unsigned        size;
+        std::string     name;
+    };
+
+    typedef std::pair<const void*, const char*> SiteKey;
+
+    const size_t                m_sample_interval;
+    size_t                      m_bytes_until_sample;
+    std::map<SiteKey, Site>     m_sites;
+    std::vector<ProcInfo>       m_procs;
+
+  public:
+    explicit AllocProfile(size_t sample_interval) :
+        m_sample_interval(sample_interval),
+        m_bytes_until_sample(sample_interval) {}
+
+    /*
+     * Register a procedure so that sites within it can be reported by
+     * name.
+     */
+    void add_proc(const std::string &name, const uint8_t *code,
+            unsigned size);
+
+    void record(const void *site, const char *what, size_t bytes) {
+        if (bytes < m_bytes_until_sample) {
+            m_bytes_until_sample -= bytes;
+        } else {
+            record_sample(site, what, bytes);
+        }
+    }
+
+    /*
+     * Print the max_sites sites that allocated the most.
+     */
+    void report(FILE *stream, unsigned max_sites) const;
+
+    AllocProfile(const AllocProfile&) = delete;
+    void operator=(const AllocProfile&) = delete;
+
+  private:
+    void record_sample(const void *site, const char *what, size_t bytes);
+
+    std::string site_name(const void *site) const;
+};
+
+} // namespace pz
+
+#endif // ! PZ_ALLOC_PROFILE_H
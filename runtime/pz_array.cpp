@@ -0,0 +1,44 @@
+/*
+ * Plasma arrays
+ * vim: ts=4 sw=4 et
+ *
+ * Copyright (C) 2019 Plasma Team
+ * Distributed under the terms of the MIT license, see ../LICENSE.code
+ */
+
+#include <string.h>
+
+#include <new>
+
+#include "pz_common.h"
+
+#include "pz_array.h"
+#include "pz_data.h"
+
+namespace pz {
+
+Array *
+Array::alloc(GCCapability &gc_cap, unsigned elem_size, uint32_t length)
+{
+    assert(valid_elem_size(elem_size));
+    void *mem = gc_cap.alloc_bytes(alloc_size(elem_size, length));
+    if (!mem) return nullptr;
+
+    Array *array = new(mem) Array(elem_size, length, false);
+    memset(array->elements(), 0, size_t(elem_size) * length);
+    return array;
+}
+
+Array *
+Array::alloc_constant(DataArena &arena, PZ_Width width, uint32_t length)
+{
+    unsigned elem_size = width_to_bytes(width);
+
+    // The arena's memory is already zeroed.
+    void *mem = arena.alloc(alloc_size(elem_size, length));
+    if (!mem) return nullptr;
+
+    return new(mem) Array(elem_size, length, true);
+}
+
+} // namespace pz
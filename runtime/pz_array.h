@@ -0,0 +1,94 @@
+/*
+ * Plasma arrays
+ * vim: ts=4 sw=4 et
+ *
+ * Copyright (C) 2019 Plasma Team
+ * Distributed under the terms of the MIT license, see ../LICENSE.code
+ */
+
+#ifndef PZ_ARRAY_H
+#define PZ_ARRAY_H
+
+#include "pz_format.h"
+#include "pz_gc_util.h"
+#include "pz_util.h"
+
+namespace pz {
+
+class DataArena;
+
+/*
+ * An array is a header, giving its length and the size of each element,
+ * followed by its elements.  Elements are 1, 2, 4 or 8 bytes, arrays of
+ * pointers use the pointer size.  The elements start on a word boundary.
+ *
+ * Arrays are allocated on the heap by the array_new builtin, or in a
+ * module's data arena by the loader for PZ_DATA_ARRAY entries.  Arrays in
+ * the arena are constant: the GC doesn't scan the arena, so a heap
+ * pointer stored in one wouldn't keep its cell alive, and the arena may
+ * be read-only.  The builtins that write to arrays refuse them.  Array
+ * values point to the header since the GC only recognises pointers to the
+ * beginning of a cell.  The GC scans every word of a cell so arrays of
+ * pointers need no special treatment.
+ */
+class Array {
+  private:
+    uint32_t    m_length;
+    uint16_t    m_elem_size;
+    bool        m_constant;
+
+    Array(unsigned elem_size, uint32_t length, bool constant) :
+        m_length(length), m_elem_size(elem_size), m_constant(constant) {}
+
+  public:
+    static bool valid_elem_size(unsigned elem_size) {
+        return elem_size == 1 || elem_size == 2 || elem_size == 4 ||
+            elem_size == 8;
+    }
+
+    static size_t alloc_size(unsigned elem_size, uint32_t length) {
+        return sizeof(Array) + size_t(elem_size) * length;
+    }
+
+    /*
+     * Allocate an array on the heap with its elements zeroed.
+     */
+    static Array * alloc(GCCapability &gc_cap, unsigned elem_size,
+            uint32_t length);
+
+    /*
+     * Allocate an array in a module's data arena, returns null if there's
+     * no memory.
+     */
+    static Array * alloc_constant(DataArena &arena, PZ_Width width,
+            uint32_t length);
+
+    uint32_t length() const { return m_length; }
+    unsigned elem_size() const { return m_elem_size; }
+    bool is_constant() const { return m_constant; }
+
+    void * elements() { return this + 1; }
+
+    void * element(uint32_t index) {
+        assert(index < m_length);
+        return reinterpret_cast<uint8_t*>(elements()) +
+            size_t(index) * m_elem_size;
+    }
+
+    /*
+     * True if the count elements starting at start are within the array.
+     */
+    bool in_bounds(uint32_t start, uint32_t count) const {
+        return start <= m_length && count <= m_length - start;
+    }
+
+    Array(const Array &) = delete;
+    void operator=(const Array &) = delete;
+};
+
+static_assert(sizeof(Array) % WORDSIZE_BYTES == 0,
+        "Array elements must be word aligned");
+
+} // namespace pz
+
+#endif /* ! PZ_ARRAY_H */
@@ -19,29 +19,29 @@ namespace pz {
 
 template<typename T>
 static void
-builtin_create(Module *module, const std::string &name,
-        unsigned (*func_make_instrs)(uint8_t *bytecode, T data), T data);
+builtin_create(Module *module, SymbolTable &symbols,
+        const std::string &name,
+        unsigned (*func_make_instrs)(uint8_t *bytecode, T data), T data,
+        const Optional<CCall> &ccall = Optional<CCall>());
 
 static void
-builtin_create_c_code(Module *module, const char *name,
-        pz_builtin_c_func c_func);
+builtin_create_c_code(Module *module, SymbolTable &symbols,
+        const char *name, pz_builtin_c_func c_func);
 
 static void
-builtin_create_c_code_alloc(Module *module, const char *name,
-        pz_builtin_c_alloc_func c_func);
+builtin_create_c_code_alloc(Module *module, SymbolTable &symbols,
+        const char *name, pz_builtin_c_alloc_func c_func);
 
 static void
-builtin_create_c_code_special(Module *module, const char *name,
-        pz_builtin_c_special_func c_func);
+builtin_create_c_code_special(Module *module, SymbolTable &symbols,
+        const char *name, pz_builtin_c_special_func c_func);
 
-static unsigned
-make_ccall_instr(uint8_t *bytecode, pz_builtin_c_func c_func);
-
-static unsigned
-make_ccall_alloc_instr(uint8_t *bytecode, pz_builtin_c_alloc_func c_func);
+static void
+builtin_create_ccall(Module *module, SymbolTable &symbols,
+        const char *name, PZ_Opcode opcode, uintptr_t c_func);
 
 static unsigned
-make_ccall_special_instr(uint8_t *bytecode, pz_builtin_c_special_func c_func);
+make_ccall_instrs(uint8_t *bytecode, CCall ccall);
 
 static unsigned
 builtin_make_tag_instrs(uint8_t *bytecode, std::nullptr_t data)
@@ -185,41 +185,99 @@ builtin_unshift_value_instrs(uint8_t *bytecode, std::nullptr_t data)
 }
 
 void
-setup_builtins(Module *module)
+setup_builtins(Module *module, SymbolTable &symbols)
 {
-    builtin_create_c_code(module,         "print",
+    builtin_create_c_code_special(module, symbols, "print",
             pz_builtin_print_func);
-    builtin_create_c_code_alloc(module,   "int_to_string",
+    builtin_create_c_code_special(module, symbols, "flush",
+            pz_builtin_flush_func);
+    builtin_create_c_code_special(module, symbols, "print_int",
+            pz_builtin_print_int_func);
+    builtin_create_c_code_alloc(module, symbols, "int_to_string",
             pz_builtin_int_to_string_func);
-    builtin_create_c_code(module,         "setenv",
+    builtin_create_c_code(module, symbols, "setenv",
             pz_builtin_setenv_func);
-    builtin_create_c_code(module,         "gettimeofday",
+    builtin_create_c_code(module, symbols, "gettimeofday",
             pz_builtin_gettimeofday_func);
-    builtin_create_c_code_alloc(module,   "concat_string",
+    builtin_create_c_code(module, symbols, "monotonic_ns",
+            pz_builtin_monotonic_ns_func);
+    builtin_create_c_code(module, symbols, "cpu_time_ns",
+            pz_builtin_cpu_time_ns_func);
+    builtin_create_c_code(module, symbols, "thread_cpu_time_ns",
+            pz_builtin_thread_cpu_time_ns_func);
+    builtin_create_c_code_alloc(module, symbols, "concat_string",
             pz_builtin_concat_string_func);
-    builtin_create_c_code(module,         "die",
+    builtin_create_c_code_alloc(module, symbols, "flatten_string",
+            pz_builtin_flatten_string_func);
+    builtin_create_c_code_alloc(module, symbols, "string_equals",
+            pz_builtin_string_equals_func);
+    builtin_create_c_code_alloc(module, symbols, "string_compare",
+            pz_builtin_string_compare_func);
+    builtin_create_c_code_alloc(module, symbols, "string_find",
+            pz_builtin_string_find_func);
+    builtin_create_c_code_alloc(module, symbols, "string_starts_with",
+            pz_builtin_string_starts_with_func);
+    builtin_create_c_code(module, symbols, "string_hash",
+            pz_builtin_string_hash_func);
+    builtin_create_c_code_alloc(module, symbols, "array_new",
+            pz_builtin_array_new_func);
+    builtin_create_c_code(module, symbols, "array_length",
+            pz_builtin_array_length_func);
+    builtin_create_c_code(module, symbols, "array_load",
+            pz_builtin_array_load_func);
+    builtin_create_c_code(module, symbols, "array_store",
+            pz_builtin_array_store_func);
+    builtin_create_c_code(module, symbols, "array_copy",
+            pz_builtin_array_copy_func);
+    builtin_create_c_code(module, symbols, "array_fill",
+            pz_builtin_array_fill_func);
+    builtin_create_c_code_alloc(module, symbols, "map_new",
+            pz_builtin_map_new_func);
+    builtin_create_c_code(module, symbols, "map_size",
+            pz_builtin_map_size_func);
+    builtin_create_c_code_alloc(module, symbols, "map_set",
+            pz_builtin_map_set_func);
+    builtin_create_c_code_alloc(module, symbols, "map_get",
+            pz_builtin_map_get_func);
+    builtin_create_c_code_alloc(module, symbols, "map_remove",
+            pz_builtin_map_remove_func);
+    builtin_create_c_code(module, symbols, "map_next",
+            pz_builtin_map_next_func);
+    builtin_create_c_code(module, symbols, "map_key",
+            pz_builtin_map_key_func);
+    builtin_create_c_code(module, symbols, "map_value",
+            pz_builtin_map_value_func);
+    builtin_create_c_code_special(module, symbols, "die",
             pz_builtin_die_func);
-    builtin_create_c_code_special(module, "set_parameter",
+    builtin_create_c_code_special(module, symbols, "set_parameter",
             pz_builtin_set_parameter_func);
-    builtin_create_c_code_special(module, "get_parameter",
+    builtin_create_c_code_special(module, symbols, "get_parameter",
             pz_builtin_get_parameter_func);
-
-    builtin_create<std::nullptr_t>(module, "make_tag",
+    builtin_create_c_code(module, symbols, "parameter_id",
+            pz_builtin_parameter_id_func);
+    builtin_create_c_code_special(module, symbols, "set_parameter_by_id",
+            pz_builtin_set_parameter_by_id_func);
+    builtin_create_c_code_special(module, symbols, "get_parameter_by_id",
+            pz_builtin_get_parameter_by_id_func);
+
+    builtin_create<std::nullptr_t>(module, symbols, "make_tag",
             builtin_make_tag_instrs,        nullptr);
-    builtin_create<std::nullptr_t>(module, "shift_make_tag",
+    builtin_create<std::nullptr_t>(module, symbols, "shift_make_tag",
             builtin_shift_make_tag_instrs,  nullptr);
-    builtin_create<std::nullptr_t>(module, "break_tag",
+    builtin_create<std::nullptr_t>(module, symbols, "break_tag",
             builtin_break_tag_instrs,       nullptr);
-    builtin_create<std::nullptr_t>(module, "break_shift_tag",
+    builtin_create<std::nullptr_t>(module, symbols, "break_shift_tag",
             builtin_break_shift_tag_instrs, nullptr);
-    builtin_create<std::nullptr_t>(module, "unshift_value",
+    builtin_create<std::nullptr_t>(module, symbols, "unshift_value",
             builtin_unshift_value_instrs,   nullptr);
 }
 
 template<typename T>
 static void
-builtin_create(Module *module, const std::string &name,
-        unsigned (*func_make_instrs)(uint8_t *bytecode, T data), T data)
+builtin_create(Module *module, SymbolTable &symbols,
+        const std::string &name,
+        unsigned (*func_make_instrs)(uint8_t *bytecode, T data), T data,
+        const Optional<CCall> &ccall)
 {
     // We forbid GC in this scope until the proc's code and closure are
     // reachable from module.  We will check for OOM before using any
@@ -229,7 +287,7 @@ builtin_create(Module *module, const std::string &name,
     // If the proc code area cannot be allocated this is GC safe because it
     // will trace the closure.  It would not work the other way around (we'd
     // have to make it faliable).
-    unsigned size = func_make_instrs(nullptr, nullptr);
+    unsigned size = func_make_instrs(nullptr, data);
     Proc proc(nogc, size);
 
     nogc.abort_if_oom("setting up builtins");
@@ -239,70 +297,60 @@ builtin_create(Module *module, const std::string &name,
 
     nogc.abort_if_oom("setting up builtins");
     // XXX: -1 is a temporary hack.
-    module->add_symbol(name, closure, (unsigned)-1);
+    if (ccall.hasValue()) {
+        module->add_symbol(symbols.intern(name), closure, (unsigned)-1,
+                ccall.value());
+    } else {
+        module->add_symbol(symbols.intern(name), closure, (unsigned)-1);
+    }
 }
 
 static void
-builtin_create_c_code(Module *module, const char *name,
-        pz_builtin_c_func c_func)
+builtin_create_c_code(Module *module, SymbolTable &symbols,
+        const char *name, pz_builtin_c_func c_func)
 {
-    builtin_create<pz_builtin_c_func>(module, name, make_ccall_instr,
-            c_func);
+    builtin_create_ccall(module, symbols, name, PZI_CCALL,
+            (uintptr_t)c_func);
 }
 
 static void
-builtin_create_c_code_alloc(Module *module, const char *name,
-        pz_builtin_c_alloc_func c_func)
+builtin_create_c_code_alloc(Module *module, SymbolTable &symbols,
+        const char *name, pz_builtin_c_alloc_func c_func)
 {
-    builtin_create<pz_builtin_c_alloc_func>(module, name,
-            make_ccall_alloc_instr, c_func);
+    builtin_create_ccall(module, symbols, name, PZI_CCALL_ALLOC,
+            (uintptr_t)c_func);
 }
 
 static void
-builtin_create_c_code_special(Module *module, const char *name,
-        pz_builtin_c_special_func c_func)
+builtin_create_c_code_special(Module *module, SymbolTable &symbols,
+        const char *name, pz_builtin_c_special_func c_func)
 {
-    builtin_create<pz_builtin_c_special_func>(module, name,
-            make_ccall_special_instr, c_func);
+    builtin_create_ccall(module, symbols, name, PZI_CCALL_SPECIAL,
+            (uintptr_t)c_func);
 }
 
-static unsigned
-make_ccall_instr(uint8_t *bytecode, pz_builtin_c_func c_func)
-{
-    ImmediateValue immediate_value;
-    unsigned       offset = 0;
-
-    immediate_value.word = (uintptr_t)c_func;
-    offset += write_instr(bytecode, offset, PZI_CCALL,
-            IMT_PROC_REF, immediate_value);
-    offset += write_instr(bytecode, offset, PZI_RET);
-
-    return offset;
-}
-
-static unsigned
-make_ccall_alloc_instr(uint8_t *bytecode, pz_builtin_c_alloc_func c_func)
+/*
+ * C builtins still get a procedure and closure so that they can be used
+ * as values, but the export also records the C function so that the loader
+ * can call it directly.
+ */
+static void
+builtin_create_ccall(Module *module, SymbolTable &symbols,
+        const char *name, PZ_Opcode opcode, uintptr_t c_func)
 {
-    ImmediateValue immediate_value;
-    unsigned       offset = 0;
-
-    immediate_value.word = (uintptr_t)c_func;
-    offset += write_instr(bytecode, offset, PZI_CCALL_ALLOC,
-            IMT_PROC_REF, immediate_value);
-    offset += write_instr(bytecode, offset, PZI_RET);
-
-    return offset;
+    CCall ccall = {opcode, c_func};
+    builtin_create<CCall>(module, symbols, name, make_ccall_instrs, ccall,
+            ccall);
 }
 
 static unsigned
-make_ccall_special_instr(uint8_t *bytecode,
-        pz_builtin_c_special_func c_func)
+make_ccall_instrs(uint8_t *bytecode, CCall ccall)
 {
     ImmediateValue immediate_value;
     unsigned       offset = 0;
 
-    immediate_value.word = (uintptr_t)c_func;
-    offset += write_instr(bytecode, offset, PZI_CCALL_SPECIAL,
+    immediate_value.word = ccall.func;
+    offset += write_instr(bytecode, offset, ccall.opcode,
             IMT_PROC_REF, immediate_value);
     offset += write_instr(bytecode, offset, PZI_RET);
 
@@ -310,4 +358,3 @@ make_ccall_special_instr(uint8_t *bytecode,
 }
 
 }
-
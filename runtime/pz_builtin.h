@@ -15,7 +15,7 @@
 namespace pz {
 
 void
-setup_builtins(Module *module);
+setup_builtins(Module *module, SymbolTable &symbols);
 
 }
 
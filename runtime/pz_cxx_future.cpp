@@ -27,3 +27,11 @@ bool startsWith(const std::string &string, const char *beginning)
     return true;
 }
 
+bool startsWith(const StringView &string, const char *beginning)
+{
+    size_t len = strlen(beginning);
+
+    return string.size() >= len &&
+        strncmp(string.data(), beginning, len) == 0;
+}
+
@@ -15,6 +15,8 @@
 #ifndef PZ_CXX_FUTURE_H
 #define PZ_CXX_FUTURE_H
 
+#include <string.h>
+
 #include <string>
 
 /*
@@ -39,19 +41,19 @@ class Optional {
     constexpr Optional() : m_present(false) {}
 
     // Implicit constructor
-    Optional(const T &val)
+    Optional(const T &val) : m_present(false)
     {
         set(val);
     }
 
-    Optional(const Optional &other)
+    Optional(const Optional &other) : m_present(false)
     {
         if (other.hasValue()) {
             set(other.value());
         }
     }
 
-    Optional(Optional &&other)
+    Optional(Optional &&other) : m_present(false)
     {
         if (other.hasValue()) {
             set(other.value());
@@ -121,10 +123,38 @@ class Optional {
     }
 };
 
+/*
+ * A reference to a string that doesn't own the string's storage, in C++17
+ * this is std::string_view.
+ */
+class StringView {
+  private:
+    const char *m_data;
+    size_t      m_len;
+
+  public:
+    constexpr StringView() : m_data(nullptr), m_len(0) {}
+    constexpr StringView(const char *data, size_t len) :
+        m_data(data), m_len(len) {}
+
+    const char * data() const { return m_data; }
+    size_t size() const { return m_len; }
+
+    std::string str() const { return std::string(m_data, m_len); }
+
+    bool operator==(const char *other) const {
+        return strncmp(m_data, other, m_len) == 0 && other[m_len] == 0;
+    }
+    bool operator!=(const char *other) const {
+        return !(*this == other);
+    }
+};
+
 /*
  * We won't need this with C++20
  */
 bool startsWith(const std::string &string, const char *beginning);
+bool startsWith(const StringView &string, const char *beginning);
 
 #endif // ! PZ_CXX_FUTURE_H
 
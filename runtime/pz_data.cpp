@@ -8,6 +8,10 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
 
 #include "pz_common.h"
 
@@ -45,18 +49,71 @@ Struct::calculate_layout()
  *
  **********/
 
+// Most modules' data fits in a single chunk this size.
+static const size_t Data_Chunk_Size = 64*1024;
+
+DataArena::~DataArena()
+{
+    for (Chunk &chunk : m_chunks) {
+        munmap(chunk.base, chunk.size);
+    }
+}
+
 void *
-data_new_array_data(GCCapability &gc_tracer,
-        PZ_Width width, uint32_t num_elements)
+DataArena::alloc(size_t size)
+{
+    assert(!m_readonly);
+    size = AlignUp(size, WORDSIZE_BYTES);
+
+    if (m_chunks.empty() || size > m_chunks.back().size - m_used) {
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t chunk_size = AlignUp(std::max(size, Data_Chunk_Size),
+                page_size);
+        void *base = mmap(nullptr, chunk_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            perror("mmap");
+            return nullptr;
+        }
+        m_chunks.push_back({static_cast<uint8_t*>(base), chunk_size});
+        m_used = 0;
+    }
+
+    void *ptr = m_chunks.back().base + m_used;
+    m_used += size;
+    return ptr;
+}
+
+void
+DataArena::add_heap_ref(void **slot)
+{
+    m_heap_refs.push_back(slot);
+}
+
+void
+DataArena::make_readonly()
 {
-    return gc_tracer.alloc_bytes(width_to_bytes(width) * num_elements);
+    for (Chunk &chunk : m_chunks) {
+        if (mprotect(chunk.base, chunk.size, PROT_READ) != 0) {
+            perror("mprotect");
+        }
+    }
+    m_readonly = true;
+}
+
+void
+DataArena::do_trace(HeapMarkState *marker) const
+{
+    for (void **slot : m_heap_refs) {
+        marker->mark_root(*slot);
+    }
 }
 
 void *
-data_new_struct_data(GCCapability &gc_tracer, size_t size)
+data_new_struct_data(DataArena &arena, size_t size)
 {
     // TODO: Use this during execution of PZT_ALLOC.
-    return gc_tracer.alloc_bytes(size);
+    return arena.alloc(size);
 }
 
 /*
@@ -88,18 +88,63 @@ width_to_bytes(PZ_Width w);
  *******/
 
 /*
- * Allocate space for array data.  If the width is 0 then the array contains
- * references to other data, and each element should be machine word sized.
+ * A module's constant data lives in an arena outside of the GC's heap, so
+ * the GC never scans it.  The only pointers from the arena into the heap
+ * (to closures) must be registered with add_heap_ref(), do_trace() marks
+ * them as roots.
+ *
+ * Slots are registered while the module is loaded, nothing may write to
+ * the arena after that.  The program is trusted not to store into data,
+ * a heap pointer it stored wouldn't be a root and its cell could be freed.
+ * Array data is marked constant so that the array builtins refuse it.
+ *
+ * The arena is freed with its module, it may be made read-only once the
+ * module is loaded, which turns such a store into a crash.
  */
-void *
-data_new_array_data(GCCapability &gc_tracer, PZ_Width width,
-    uint32_t num_elements);
+class DataArena {
+  private:
+    struct Chunk {
+        uint8_t    *base;
+        size_t      size;
+    };
+
+    std::vector<Chunk>      m_chunks;
+    // The number of bytes used in the last chunk.
+    size_t                  m_used;
+    std::vector<void**>     m_heap_refs;
+    bool                    m_readonly;
+
+  public:
+    DataArena() : m_used(0), m_readonly(false) {}
+    ~DataArena();
+
+    /*
+     * Allocate zeroed, word aligned, memory.  Returns null if no memory
+     * is available.
+     */
+    void * alloc(size_t size);
+
+    /*
+     * Register a slot within the arena that points into the heap.
+     */
+    void add_heap_ref(void **slot);
+
+    /*
+     * Make the arena read-only, nothing more may be allocated.
+     */
+    void make_readonly();
+
+    void do_trace(HeapMarkState *marker) const;
+
+    DataArena(const DataArena&) = delete;
+    void operator=(const DataArena&) = delete;
+};
 
 /*
  * Allocate space for struct data.
  */
 void *
-data_new_struct_data(GCCapability &gc_tracer, size_t size);
+data_new_struct_data(DataArena &arena, size_t size);
 
 /*
  * Functions for storing data in memory
@@ -2,7 +2,7 @@
  * Plasma bytecode format constants
  * vim: ts=4 sw=4 et
  *
- * Copyright (C) 2015-2016 Plasma Team
+ * Copyright (C) 2015-2016, 2019 Plasma Team
  * Distributed under the terms of the MIT license, see ../LICENSE.code
  *
  * This file is used by both the tools in runtime/ and src/
@@ -20,6 +20,16 @@ extern "C" {
  * unsigned integers in big-endian format unless otherwise specified.
  * Strings are ANSI strings without a null terminated byte.  Their length is
  * usually given by a 16 bit number that precedes them.
+ *
+ * Counts and IDs are Varints, unsigned LEB128 numbers: seven bits per
+ * byte, least significant first, with the high bit set on every byte but
+ * the last.  Numbers in data and instructions' 16 and 32 bit immediate
+ * values are SVarints, signed LEB128 numbers whose last byte's 0x40 bit is
+ * the sign.
+ *
+ * Before version 3 every Varint was a 32 bit number (except for an array's
+ * NumElements which was 16 bits), every SVarint was a number of its
+ * value's width and every DataValue began with its encoding.
  */
 
 /*
@@ -32,10 +42,28 @@ extern "C" {
  * the file's entries.
  *
  *   PZ ::= Magic DescString VersionNumber Options
- *          NumImportProcs(32bit) NumStructs(32bit) NumDatas(32bit)
- *          NumProcs(32bit) NumClosures(32bit)
+ *          NumImportProcs(Varint) NumStructs(Varint) NumDatas(Varint)
+ *          NumProcs(Varint) NumClosures(Varint) NumExports(Varint)
+ *          Directory
  *          ImportProcRef* StructEntry* DataEntry* ProcEntry*
- *          ClosureEntry*
+ *          ClosureEntry* ExportEntry*
+ *
+ * Directory
+ * ---------
+ *
+ *  The directory allows a reader to find any section, data item or
+ *  procedure without reading what comes before it.  It gives the file
+ *  offset of each section, in the order of the PZ_Section enum, then the
+ *  offset of each data item and of each procedure.  All offsets are from
+ *  the beginning of the file.  They have a fixed width so that a writer
+ *  can fill them in after writing the rest of the file.
+ *
+ *   Directory ::= SectionOffset(32bit){PZ_NUM_SECTIONS}
+ *                 DataOffset(32bit)* ProcOffset(32bit)*
+ *
+ *  Version 0 files have no directory, they may still be read.  Version 1
+ *  files have neither NumExports nor the exports section, and so their
+ *  directory has one less section offset.
  *
  * Options
  * -------
@@ -58,14 +86,16 @@ extern "C" {
  * -------
  *
  *  Import proc refs map IDs onto procedure names to be provided by other
- *  modules.  Imported procedures are identified by a high 31st bit.
+ *  modules.  Imported procedures are identified by a high 31st bit.  The
+ *  runtime reads a module called Name from Name.pz in the same directory
+ *  as the module that imports it.
  *
  *   ImportProcRef ::= ModuleName(String) ProcName(String)
  *
  * Struct information
  * ------------------
  *
- *   StructEntry ::= NumFields(32bit) Width*
+ *   StructEntry ::= NumFields(Varint) Width*
  *
  * Constant data
  * -------------
@@ -82,35 +112,51 @@ extern "C" {
  * like an array of structs.)
  *
  *   DataType ::= DATA_BASIC(8) Width
- *              | DATA_ARRAY(8) NumElements(16) Width
- *              | DATA_STRUCT(8) StructRef
+ *              | DATA_ARRAY(8) NumElements(Varint) Width
+ *              | DATA_STRUCT(8) StructRef(Varint)
+ *              | DATA_STRING(8) Length(Varint) Byte*
+ *
+ *  A string's bytes follow its length directly, there are no DataValues.
  *
  *  Which data value depends upon context.
  *
- *   DataValue ::= ENC_NORMAL NumBytes Byte*
- *               | ENC_FAST 4 Byte*
- *               | ENC_WPTR 4 Byte*
- *               | ENC_DATA 4 DataIndex(32bit)
- *               | ENC_IMPORT 4 ImportIndex(32bit)
- *               | ENC_CLOSURE 4 ClosureIndex(32bit)
+ *   DataValue ::= ENC_NORMAL NumBytes Number(SVarint)
+ *               | ENC_FAST 4 Number(SVarint)
+ *               | ENC_WPTR 4 Number(SVarint)
+ *               | ENC_DATA 4 DataIndex(Varint)
+ *               | ENC_IMPORT 4 ImportIndex(Varint)
+ *               | ENC_CLOSURE 4 ClosureIndex(Varint)
  *
  *  The encoding type and number of bytes are a single byte made up by
  *  PZ_MAKE_ENC below.  Currently fast words and pointer-sized words are
- *  always 32bit.
+ *  always 32bit.  The elements of an array whose width isn't PZW_PTR are
+ *  all numbers, their encoding follows from the array's width and is left
+ *  out.
  *
  * Code
  * ----
  *
- *   ProcEntry ::= NumBlocks(32bit) Block+
- *   Block ::= NumInstructions(32bit) Instruction+
+ *   ProcEntry ::= NumBlocks(Varint) Block+
+ *   Block ::= NumInstructions(Varint) Instruction+
  *
  *   Instruction ::= Opcode(8bit) WidthByte{0,2} Immediate?
  *      InstructionStream?
  *
+ *  8 and 64 bit immediate values are written with their full width, 16
+ *  and 32 bit values are SVarints and references are Varints.  A
+ *  struct field reference is a StructRef(Varint) and a FieldNum(8bit).
+ *
  * Closures
  * --------
  *
- *   ClosureEntry ::= ProcId(32bit) DataId(32bit)
+ *   ClosureEntry ::= ProcId(Varint) DataId(Varint)
+ *
+ * Exports
+ * -------
+ *
+ *  Exports name the closures that other modules may import.
+ *
+ *   ExportEntry ::= Name(String) ClosureId(Varint)
  *
  * Shared items
  * ------------
@@ -128,7 +174,20 @@ extern "C" {
 
 #define PZ_MAGIC_NUMBER         0x505A
 #define PZ_MAGIC_STRING_PART    "Plasma abstract machine bytecode"
-#define PZ_FORMAT_VERSION       0
+#define PZ_FORMAT_VERSION       3
+#define PZ_FORMAT_VERSION_NO_DIRECTORY  0
+#define PZ_FORMAT_VERSION_NO_EXPORTS    1
+#define PZ_FORMAT_VERSION_FIXED_WIDTH   2
+
+enum PZ_Section {
+    PZ_SECTION_IMPORTS,
+    PZ_SECTION_STRUCTS,
+    PZ_SECTION_DATAS,
+    PZ_SECTION_PROCS,
+    PZ_SECTION_CLOSURES,
+    PZ_SECTION_EXPORTS,
+    PZ_NUM_SECTIONS
+};
 
 #define PZ_OPT_ENTRY_CLOSURE    0
     /* Value: 32bit number of the program's entry closure */
@@ -147,6 +206,7 @@ enum PZ_Width {
 
 #define PZ_DATA_ARRAY           0
 #define PZ_DATA_STRUCT          1
+#define PZ_DATA_STRING          2
 
 /*
  * The high bits of a data width give the width type.  Width types are:
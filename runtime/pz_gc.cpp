@@ -13,6 +13,8 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include "pz_util.h"
 
 #include "pz_gc.h"
@@ -95,13 +97,28 @@ heap_get_collections(const Heap *heap)
     return heap->collections();
 }
 
-bool
-BBlock::is_empty() const
+uint64_t
+heap_get_total_gc_time(const Heap *heap)
 {
-    for (unsigned i = 0; i < m_wilderness; i++) {
-        if (m_blocks[i].is_in_use()) return false;
-    }
-    return true;
+    return heap->total_gc_time();
+}
+
+uint64_t
+heap_get_max_pause(const Heap *heap)
+{
+    return heap->max_pause();
+}
+
+uint64_t
+heap_get_p99_pause(const Heap *heap)
+{
+    return heap->p99_pause();
+}
+
+const GCCollectionStats *
+heap_get_last_collection(const Heap *heap)
+{
+    return heap->last_collection();
 }
 
 bool Heap::is_empty() const
@@ -124,6 +141,9 @@ Heap::Heap(const Options &options_, AbstractGCTracer &trace_global_roots_)
         , m_bblock(nullptr)
         , m_max_size(GC_Heap_Size)
         , m_collections(0)
+        , m_stats()
+        , m_total_gc_time(0)
+        , m_max_pause(0)
         , m_trace_global_roots(trace_global_roots_)
 #ifdef PZ_DEV
         , m_in_no_gc_scope(false)
@@ -166,6 +186,10 @@ Heap::finalise()
     if (!m_bblock)
         return true;
 
+    if (m_options.gc_stats()) {
+        print_gc_stats(stderr);
+    }
+
     bool result = -1 != munmap(m_bblock, GC_Max_Heap_Size);
     if (!result) {
         perror("munmap");
@@ -210,6 +234,9 @@ Heap::set_max_size(size_t new_size)
 
     if (new_size < m_bblock->size()) return false;
 
+    // The heap is a single BBlock, it can't grow beyond that.
+    if (new_size > GC_Max_Heap_Size) return false;
+
 #ifdef PZ_DEV
     if (m_options.gc_trace()) {
         fprintf(stderr, "New heap size: %ld\n", new_size);
@@ -236,18 +263,50 @@ Heap::collections() const
     return m_collections;
 }
 
-size_t
-BBlock::size() const
+const GCCollectionStats *
+Heap::last_collection() const
+{
+    if (m_collections == 0) return nullptr;
+    return &m_stats[(m_collections - 1) % GC_Stats_History];
+}
+
+uint64_t
+Heap::p99_pause() const
 {
-    size_t num_blocks = 0;
+    unsigned num_stats = std::min(m_collections, GC_Stats_History);
+    if (num_stats == 0) return 0;
 
-    for (unsigned i = 0; i < m_wilderness; i++) {
-        if (m_blocks[i].is_in_use()) {
-            num_blocks += 1;
-        }
+    uint64_t pauses[GC_Stats_History];
+    for (unsigned i = 0; i < num_stats; i++) {
+        pauses[i] = m_stats[i].end_time - m_stats[i].start_time;
     }
+    std::sort(pauses, pauses + num_stats);
 
-    return num_blocks * GC_LBlock_Size;
+    // The smallest pause that at least 99% of pauses are less than or
+    // equal to.
+    unsigned index = (num_stats * 99 + 99) / 100 - 1;
+    return pauses[index];
+}
+
+void
+Heap::print_gc_stats(FILE *stream) const
+{
+    fprintf(stream, "# collections: %u, total_gc_time_ns: %" PRIu64
+            ", max_pause_ns: %" PRIu64 ", p99_pause_ns: %" PRIu64 "\n",
+            m_collections, m_total_gc_time, m_max_pause, p99_pause());
+    fprintf(stream, "collection\tstart_ns\tend_ns\tmark_ns\tsweep_ns\t"
+            "cells_marked\tbytes_freed\theap_size_before\theap_size_after\n");
+
+    unsigned first = m_collections > GC_Stats_History ?
+        m_collections - GC_Stats_History : 0;
+    for (unsigned num = first; num < m_collections; num++) {
+        const GCCollectionStats &stats = m_stats[num % GC_Stats_History];
+        fprintf(stream, "%u\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%"
+                PRIu64 "\t%u\t%zu\t%zu\t%zu\n",
+                num, stats.start_time, stats.end_time, stats.mark_time,
+                stats.sweep_time, stats.cells_marked, stats.bytes_freed,
+                stats.heap_size_before, stats.heap_size_after);
+    }
 }
 
 /***************************************************************************/
@@ -284,9 +343,20 @@ BBlock::check()
 {
     assert(m_wilderness < GC_LBlock_Per_BBlock);
 
+    unsigned num_in_use = 0;
+    size_t allocated_bytes = 0;
     for (unsigned i = 0; i < m_wilderness; i++) {
         m_blocks[i].check();
+        if (m_blocks[i].is_in_use()) {
+            num_in_use++;
+            allocated_bytes += m_blocks[i].num_allocated() *
+                m_blocks[i].size() * WORDSIZE_BYTES;
+        }
     }
+
+    // Check that the running totals are accurate.
+    assert(num_in_use == m_num_lblocks_in_use);
+    assert(allocated_bytes == m_allocated_bytes);
 }
 
 void
@@ -333,6 +403,12 @@ LBlock::is_in_free_list(CellPtr &search)
     return false;
 }
 
+unsigned
+LBlock::num_allocated()
+{
+    return num_cells() - num_free();
+}
+
 unsigned
 LBlock::num_free()
 {
@@ -366,6 +442,13 @@ BBlock::print_usage_stats() const
     printf("Num lblocks: %d/%ld, %ldKB\n",
         m_wilderness, GC_LBlock_Per_BBlock,
         m_wilderness * GC_LBlock_Size / 1024);
+    printf("In use lblocks: %d, allocated: %ldKB\n",
+        m_num_lblocks_in_use, m_allocated_bytes / 1024);
+    for (unsigned size = 0; size <= LBlock::Max_Cell_Size; size++) {
+        if (m_live_cells[size]) {
+            printf("Live %d-word cells: %d\n", size, m_live_cells[size]);
+        }
+    }
     for (unsigned i = 0; i < m_wilderness; i++) {
         m_blocks[i].print_usage_stats();
     }
@@ -9,11 +9,15 @@
 #ifndef PZ_GC_H
 #define PZ_GC_H
 
+#include <vector>
+
 #include "pz_option.h"
 
 namespace pz {
 
 class AbstractGCTracer;
+class CellPtr;
+class LBlock;
 
 class Heap;
 
@@ -45,18 +49,113 @@ heap_get_size(const Heap *heap);
 unsigned
 heap_get_collections(const Heap *heap);
 
+/*
+ * The total time spent in the GC and the longest single collection, in
+ * nanoseconds.
+ */
+uint64_t
+heap_get_total_gc_time(const Heap *heap);
+uint64_t
+heap_get_max_pause(const Heap *heap);
+
+/*
+ * The 99th percentile collection time in nanoseconds, this is calculated
+ * over the collections that are still in the statistics history (the most
+ * recent GC_Stats_History collections).
+ */
+uint64_t
+heap_get_p99_pause(const Heap *heap);
+
+/*
+ * Statistics about a single collection.  Times are taken from a monotonic
+ * clock and are in nanoseconds, sizes are in bytes.
+ */
+struct GCCollectionStats {
+    uint64_t    start_time;
+    uint64_t    end_time;
+    uint64_t    mark_time;
+    uint64_t    sweep_time;
+    unsigned    cells_marked;
+    size_t      bytes_freed;
+    size_t      heap_size_before;
+    size_t      heap_size_after;
+};
+
+/*
+ * Statistics for the most recent collection, or null if there hasn't been
+ * one.
+ */
+const GCCollectionStats *
+heap_get_last_collection(const Heap *heap);
+
+/*
+ * The number of collections that we keep statistics for.
+ */
+constexpr unsigned GC_Stats_History = 256;
+
+
+/*
+ * Cells of up to this many words are allocated from a mutator's
+ * AllocBuffers, larger cells are allocated directly from the shared heap.
+ * Small cells are always a multiple of two words, so there's one buffer for
+ * each even size.
+ */
+constexpr unsigned GC_Buffered_Max_Cell_Size = 16;
+constexpr unsigned GC_Num_Alloc_Buffers = GC_Buffered_Max_Cell_Size / 2;
+
+/*
+ * Allocation buffers for a single mutator.
+ *
+ * Each mutator owns a "current" LBlock for each small size class and
+ * allocates from it without touching any shared heap state.  No other
+ * mutator will allocate from an owned block.  Only taking a new block and
+ * collecting use the heap's shared state, and that is protected by the
+ * heap's lock.
+ *
+ * The buffers are registered with the heap so that the GC can take their
+ * blocks back before it collects.
+ */
+class AllocBuffers {
+  private:
+    Heap       *m_heap;
+    LBlock     *m_blocks[GC_Num_Alloc_Buffers];
+
+    /*
+     * The number of cells allocated from each block that havn't yet been
+     * added to the heap's running totals.
+     */
+    unsigned    m_num_unaccounted[GC_Num_Alloc_Buffers];
+
+    friend class Heap;
+
+  public:
+    explicit AllocBuffers(Heap *heap);
+    ~AllocBuffers();
+
+    AllocBuffers(const AllocBuffers&) = delete;
+    void operator=(const AllocBuffers&) = delete;
+};
 
 class HeapMarkState {
   private:
     unsigned    num_marked;
     unsigned    num_roots_marked;
+    size_t      num_bytes_marked;
 
     Heap       *heap;
 
+    /*
+     * Pointers found in the fields of marked cells that havn't been
+     * examined yet.  They may not point to valid or unmarked cells,
+     * they're checked as they're taken off the stack.
+     */
+    std::vector<void*> mark_stack;
+
   public:
     explicit HeapMarkState(Heap *heap_) :
         num_marked(0),
         num_roots_marked(0),
+        num_bytes_marked(0),
         heap(heap_) {}
 
     /*
@@ -86,8 +185,34 @@ class HeapMarkState {
     void
     mark_root_conservative_interior(void *root, size_t len);
 
+    /*
+     * Mark everything reachable from the roots marked so far.  This must
+     * be called after all the roots have been traced.
+     */
+    void
+    mark_reachable();
+
+    unsigned
+    cells_marked() const { return num_marked; }
+
+    /*
+     * mark_time is the time in nanoseconds spent marking.
+     */
+    void
+    print_stats(FILE *stream, uint64_t mark_time);
+
+  private:
+    /*
+     * Mark the cell and push its fields onto the mark stack.
+     */
+    void
+    mark(CellPtr &cell);
+
+    /*
+     * Mark ptr if it points to a valid unmarked cell.
+     */
     void
-    print_stats(FILE *stream);
+    mark_candidate(void *ptr);
 };
 
 } // namespace pz
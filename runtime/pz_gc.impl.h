@@ -9,6 +9,9 @@
 #ifndef PZ_GC_IMPL_H
 #define PZ_GC_IMPL_H
 
+#include <mutex>
+#include <vector>
+
 #include "pz_gc.h"
 
 namespace pz {
@@ -25,8 +28,23 @@ class Heap {
     size_t              m_max_size;
     unsigned            m_collections;
 
+    // Statistics for the most recent collections, indexed by the
+    // collection number modulo GC_Stats_History.  The totals cover every
+    // collection.
+    GCCollectionStats   m_stats[GC_Stats_History];
+    uint64_t            m_total_gc_time;
+    uint64_t            m_max_pause;
+
     AbstractGCTracer   &m_trace_global_roots;
 
+    /*
+     * The lock protects the shared heap state: the BBlock, its running
+     * totals and the set of registered allocation buffers.  Allocating
+     * from a mutator's own AllocBuffers doesn't need it.
+     */
+    std::mutex                  m_lock;
+    std::vector<AllocBuffers*>  m_alloc_buffers;
+
   public:
     Heap(const Options &options, AbstractGCTracer &trace_global_roots);
     ~Heap();
@@ -44,6 +62,18 @@ class Heap {
 
     unsigned collections() const;
 
+    uint64_t total_gc_time() const { return m_total_gc_time; }
+    uint64_t max_pause() const { return m_max_pause; }
+    uint64_t p99_pause() const;
+
+    const GCCollectionStats * last_collection() const;
+
+    /*
+     * Write the statistics for the collections in the history, oldest
+     * first, as tab-seperated values with a header line.
+     */
+    void print_gc_stats(FILE *stream) const;
+
     Heap(const Heap &) = delete;
     Heap& operator=(const Heap &) = delete;
 
@@ -60,11 +90,29 @@ class Heap {
 
     bool is_empty() const;
 
-    unsigned mark(CellPtr &cell);
-
     void sweep();
 
-    void * try_allocate(size_t size_in_words);
+    void * try_allocate(size_t size_in_words, AllocBuffers *buffers);
+
+    // The caller must hold m_lock.
+    void * try_allocate_shared(size_t size_in_words);
+
+    // Allocate from the buffers, refilling the buffer for this size if
+    // necessary.
+    void * try_allocate_buffered(size_t size_in_words,
+            AllocBuffers &buffers);
+
+    friend class AllocBuffers;
+    void register_alloc_buffers(AllocBuffers *buffers);
+    void unregister_alloc_buffers(AllocBuffers *buffers);
+
+    /*
+     * Give the current block of one or all of a mutator's buffers back to
+     * the heap and account for the cells allocated from it.  The caller
+     * must hold m_lock.
+     */
+    void release_alloc_buffer(AllocBuffers &buffers, unsigned index);
+    void release_alloc_buffers(AllocBuffers &buffers);
 
     LBlock * get_lblock_for_allocation(size_t size_in_words);
 
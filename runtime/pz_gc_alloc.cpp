@@ -10,6 +10,8 @@
 
 #include <string.h>
 
+#include <algorithm>
+
 #include "pz_util.h"
 
 #include "pz_gc.h"
@@ -26,6 +28,7 @@ Heap::alloc(size_t size_in_words, GCCapability &gc_cap)
     assert(size_in_words > 0);
 
     void *cell;
+    AllocBuffers *buffers = gc_cap.alloc_buffers();
 #ifdef PZ_DEV
     assert(m_in_no_gc_scope == !gc_cap.can_gc());
     if (m_options.gc_zealous() &&
@@ -37,11 +40,11 @@ Heap::alloc(size_t size_in_words, GCCapability &gc_cap)
     } else
 #endif
     {
-        cell = try_allocate(size_in_words);
+        cell = try_allocate(size_in_words, buffers);
     }
     if (cell == NULL && gc_cap.can_gc()) {
         collect(&gc_cap.tracer());
-        cell = try_allocate(size_in_words);
+        cell = try_allocate(size_in_words, buffers);
     }
     
     if (cell == NULL) {
@@ -60,7 +63,7 @@ Heap::alloc_bytes(size_t size_in_bytes, GCCapability &gc_cap) {
 }
 
 void *
-Heap::try_allocate(size_t size_in_words)
+Heap::try_allocate(size_t size_in_words, AllocBuffers *buffers)
 {
     if (size_in_words < GC_Min_Cell_Size) {
         size_in_words = GC_Min_Cell_Size;
@@ -75,6 +78,17 @@ Heap::try_allocate(size_t size_in_words)
         abort();
     }
 
+    if (buffers && size_in_words <= GC_Buffered_Max_Cell_Size) {
+        return try_allocate_buffered(size_in_words, *buffers);
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    return try_allocate_shared(size_in_words);
+}
+
+void *
+Heap::try_allocate_shared(size_t size_in_words)
+{
     /*
      * Try the free list
      */
@@ -95,6 +109,7 @@ Heap::try_allocate(size_t size_in_words)
     CellPtr cell = block->allocate_cell();
 
     if (!cell.is_valid()) return nullptr;
+    m_bblock->cells_allocated(size_in_words);
 
     #ifdef PZ_DEV
     if (m_options.gc_trace2()) {
@@ -105,6 +120,91 @@ Heap::try_allocate(size_t size_in_words)
     return cell.pointer();
 }
 
+void *
+Heap::try_allocate_buffered(size_t size_in_words, AllocBuffers &buffers)
+{
+    unsigned index = size_in_words / 2 - 1;
+    assert(index < GC_Num_Alloc_Buffers);
+
+    /*
+     * The fast path, the block is ours so we don't need the lock.
+     */
+    LBlock *block = buffers.m_blocks[index];
+    if (block) {
+        CellPtr cell = block->allocate_cell();
+        if (cell.is_valid()) {
+            buffers.m_num_unaccounted[index]++;
+            return cell.pointer();
+        }
+    }
+
+    /*
+     * The block is full or we don't have one.  Give it back and take
+     * another.
+     */
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    if (block) {
+        release_alloc_buffer(buffers, index);
+    }
+
+    block = get_lblock_for_allocation(size_in_words);
+    if (!block) {
+        block = allocate_block(size_in_words);
+        if (!block) return nullptr;
+    }
+    block->set_owned(true);
+    buffers.m_blocks[index] = block;
+
+    CellPtr cell = block->allocate_cell();
+    assert(cell.is_valid());
+    buffers.m_num_unaccounted[index]++;
+
+    return cell.pointer();
+}
+
+void
+Heap::register_alloc_buffers(AllocBuffers *buffers)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_alloc_buffers.push_back(buffers);
+}
+
+void
+Heap::unregister_alloc_buffers(AllocBuffers *buffers)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    release_alloc_buffers(*buffers);
+    auto iter = std::find(m_alloc_buffers.begin(), m_alloc_buffers.end(),
+            buffers);
+    assert(iter != m_alloc_buffers.end());
+    m_alloc_buffers.erase(iter);
+}
+
+void
+Heap::release_alloc_buffer(AllocBuffers &buffers, unsigned index)
+{
+    LBlock *block = buffers.m_blocks[index];
+    if (!block) return;
+
+    assert(block->is_owned());
+    block->set_owned(false);
+    m_bblock->cells_allocated(block->size(),
+            buffers.m_num_unaccounted[index]);
+
+    buffers.m_blocks[index] = nullptr;
+    buffers.m_num_unaccounted[index] = 0;
+}
+
+void
+Heap::release_alloc_buffers(AllocBuffers &buffers)
+{
+    for (unsigned i = 0; i < GC_Num_Alloc_Buffers; i++) {
+        release_alloc_buffer(buffers, i);
+    }
+}
+
 LBlock *
 Heap::get_lblock_for_allocation(size_t size_in_words)
 {
@@ -118,7 +218,7 @@ BBlock::get_lblock_for_allocation(size_t size_in_words)
         LBlock *lblock = &(m_blocks[i]);
 
         if (lblock->is_in_use() && lblock->size() == size_in_words &&
-                !lblock->is_full())
+                !lblock->is_owned() && !lblock->is_full())
         {
             return lblock;
         }
@@ -157,6 +257,7 @@ BBlock::allocate_block()
             fprintf(stderr,
                 "Running previously-unused code path, "
                 "see https://github.com/PlasmaLang/plasma/issues/191\n");
+            m_num_lblocks_in_use++;
             return &m_blocks[i];
         }
     }
@@ -164,6 +265,7 @@ BBlock::allocate_block()
     if (m_wilderness >= GC_LBlock_Per_BBlock)
         return nullptr;
 
+    m_num_lblocks_in_use++;
     return &m_blocks[m_wilderness++];
 }
 
@@ -185,4 +287,19 @@ LBlock::allocate_cell()
     return cell;
 }
 
+/***************************************************************************/
+
+AllocBuffers::AllocBuffers(Heap *heap) :
+    m_heap(heap),
+    m_blocks(),
+    m_num_unaccounted()
+{
+    m_heap->register_alloc_buffers(this);
+}
+
+AllocBuffers::~AllocBuffers()
+{
+    m_heap->unregister_alloc_buffers(this);
+}
+
 } // namespace pz
@@ -9,6 +9,9 @@
 #include "pz_common.h"
 
 #include <string.h>
+#include <time.h>
+
+#include <algorithm>
 
 #include "pz_util.h"
 
@@ -32,11 +35,41 @@ REMOVE_TAG(void* tagged_ptr) {
             reinterpret_cast<uintptr_t>(tagged_ptr) & (~0 ^ TAG_BITS));
 }
 
+/*
+ * The number of candidate pointers the mark loop keeps in flight.  Each
+ * candidate is prefetched as it enters the queue and examined once this
+ * many other candidates have entered after it.  This must be a power of
+ * two.
+ */
+constexpr unsigned GC_Mark_Prefetch_Depth = 8;
+
+static_assert((GC_Mark_Prefetch_Depth & (GC_Mark_Prefetch_Depth - 1)) == 0,
+        "GC_Mark_Prefetch_Depth must be a power of two");
+
+static uint64_t
+monotonic_nanoseconds()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
 void
 Heap::collect(const AbstractGCTracer *trace_thread_roots)
 {
+    std::lock_guard<std::mutex> lock(m_lock);
     HeapMarkState state(this);
 
+    /*
+     * Take back every mutator's allocation buffers so that the running
+     * totals are accurate and no mutator keeps a block that the sweep may
+     * free.
+     */
+    for (AllocBuffers *buffers : m_alloc_buffers) {
+        release_alloc_buffers(*buffers);
+    }
+
     // There's nothing to collect, the heap is empty.
     if (is_empty()) return;
 
@@ -48,6 +81,11 @@ Heap::collect(const AbstractGCTracer *trace_thread_roots)
     }
 #endif
 
+    GCCollectionStats &stats = m_stats[m_collections % GC_Stats_History];
+    stats.start_time = monotonic_nanoseconds();
+    stats.heap_size_before = m_bblock->size();
+    size_t allocated_before = m_bblock->allocated_bytes();
+
 #ifdef PZ_DEV
     if (m_options.gc_trace()) {
         fprintf(stderr, "Tracing from global roots\n");
@@ -73,13 +111,27 @@ Heap::collect(const AbstractGCTracer *trace_thread_roots)
     }
 #endif
 
+    state.mark_reachable();
+    uint64_t sweep_start = monotonic_nanoseconds();
+    stats.mark_time = sweep_start - stats.start_time;
+    stats.cells_marked = state.cells_marked();
+
 #ifdef PZ_DEV
     if (m_options.gc_trace()) {
-        state.print_stats(stderr);
+        state.print_stats(stderr, stats.mark_time);
     }
 #endif
 
     sweep();
+
+    stats.end_time = monotonic_nanoseconds();
+    stats.sweep_time = stats.end_time - sweep_start;
+    stats.bytes_freed = allocated_before - m_bblock->allocated_bytes();
+    stats.heap_size_after = m_bblock->size();
+
+    uint64_t pause = stats.end_time - stats.start_time;
+    m_total_gc_time += pause;
+    m_max_pause = std::max(m_max_pause, pause);
     m_collections++;
 
 #ifdef PZ_DEV
@@ -92,34 +144,6 @@ Heap::collect(const AbstractGCTracer *trace_thread_roots)
 #endif
 }
 
-unsigned
-Heap::mark(CellPtr &cell)
-{
-    unsigned num_marked = 0;
-
-    assert(cell.is_valid());
-    LBlock *lblock = cell.lblock();
-
-    lblock->mark(cell);
-    num_marked++;
-
-    void **ptr = cell.pointer();
-    for (unsigned i = 0; i < lblock->size(); i++) {
-        void *cur = REMOVE_TAG(ptr[i]);
-        if (is_valid_cell(cur)) {
-            CellPtr field = ptr_to_cell(cur);
-            LBlock *field_lblock = field.lblock();
-
-            if (field_lblock->is_allocated(field) &&
-                    !field_lblock->is_marked(field)) {
-                num_marked += mark(field);
-            }
-        }
-    }
-
-    return num_marked;
-}
-
 void
 Heap::sweep()
 {
@@ -129,17 +153,33 @@ Heap::sweep()
 void
 BBlock::sweep(const Options &options)
 {
+    /*
+     * We visit every block anyway, so recount the live cells rather than
+     * trying to adjust the previous counts.
+     */
+    memset(m_live_cells, 0, sizeof(m_live_cells));
+    m_allocated_bytes = 0;
+
     for (unsigned i = 0; i < m_wilderness; i++) {
-        if (m_blocks[i].sweep(options)) {
-            m_blocks[i].make_unused();
+        LBlock &lblock = m_blocks[i];
+        if (!lblock.is_in_use()) continue;
+
+        unsigned num_used = lblock.sweep(options);
+        if (num_used == 0) {
+            lblock.make_unused();
+            assert(m_num_lblocks_in_use > 0);
+            m_num_lblocks_in_use--;
+        } else {
+            m_live_cells[lblock.size()] += num_used;
+            m_allocated_bytes += num_used * lblock.size() * WORDSIZE_BYTES;
         }
     }
 }
 
-bool
+unsigned
 LBlock::sweep(const Options &options)
 {
-    if (!is_in_use()) return true;
+    if (!is_in_use()) return 0;
 
     int free_list = Header::Empty_Free_List;
     unsigned num_used = 0;
@@ -165,12 +205,13 @@ LBlock::sweep(const Options &options)
 
     m_header.free_list = free_list;
 
-    return num_used == 0;
+    return num_used;
 }
 
 void
 LBlock::make_unused()
 {
+    assert(!m_header.owned);
     m_header.block_type_or_size = Header::Block_Empty;
 }
 
@@ -185,7 +226,7 @@ HeapMarkState::mark_root(void *heap_ptr)
         LBlock *lblock = cell.lblock();
 
         if (lblock->is_allocated(cell) && !lblock->is_marked(cell)) {
-            num_marked += heap->mark(cell);
+            mark(cell);
             num_roots_marked++;
         }
     }
@@ -233,12 +274,96 @@ HeapMarkState::mark_root_conservative_interior(void *root, size_t len)
 }
 
 void
-HeapMarkState::print_stats(FILE *stream)
+HeapMarkState::mark_reachable()
+{
+    /*
+     * Candidates pass through a small FIFO between the mark stack and
+     * being examined.  Examining a candidate reads its LBlock header and
+     * the cell itself, both are likely cache misses, so we prefetch them
+     * as the candidate enters the FIFO and hope they've arrived by the
+     * time it leaves.
+     */
+    void       *queue[GC_Mark_Prefetch_Depth];
+    unsigned    queue_head = 0;
+    unsigned    queue_len = 0;
+    const unsigned queue_mask = GC_Mark_Prefetch_Depth - 1;
+
+    while (!mark_stack.empty() || queue_len > 0) {
+        void *ptr;
+
+        if (!mark_stack.empty()) {
+            void *next = mark_stack.back();
+            mark_stack.pop_back();
+
+            __builtin_prefetch(ptr_to_lblock(next));
+            __builtin_prefetch(next);
+
+            if (queue_len < GC_Mark_Prefetch_Depth) {
+                queue[(queue_head + queue_len) & queue_mask] = next;
+                queue_len++;
+                continue;
+            }
+
+            ptr = queue[queue_head];
+            queue[queue_head] = next;
+        } else {
+            ptr = queue[queue_head];
+            queue_len--;
+        }
+        queue_head = (queue_head + 1) & queue_mask;
+
+        mark_candidate(ptr);
+    }
+}
+
+void
+HeapMarkState::mark(CellPtr &cell)
+{
+    assert(cell.is_valid());
+    LBlock *lblock = cell.lblock();
+
+    lblock->mark(cell);
+    num_marked++;
+    num_bytes_marked += lblock->size() * WORDSIZE_BYTES;
+
+    void **ptr = cell.pointer();
+    for (unsigned i = 0; i < lblock->size(); i++) {
+        void *cur = REMOVE_TAG(ptr[i]);
+        // Only the cheap range check is made here, the rest of the checks
+        // need the LBlock header and are made in mark_candidate() once it
+        // has been prefetched.
+        if (heap->m_bblock->contains_pointer(cur)) {
+            mark_stack.push_back(cur);
+        }
+    }
+}
+
+void
+HeapMarkState::mark_candidate(void *ptr)
+{
+    if (heap->is_valid_cell(ptr)) {
+        CellPtr cell = heap->ptr_to_cell(ptr);
+        LBlock *lblock = cell.lblock();
+
+        if (lblock->is_allocated(cell) && !lblock->is_marked(cell)) {
+            mark(cell);
+        }
+    }
+}
+
+void
+HeapMarkState::print_stats(FILE *stream, uint64_t mark_time)
 {
     fprintf(stream,
             "Marked %d root pointers, marked %u pointers total\n",
             num_roots_marked,
             num_marked);
+    fprintf(stream,
+            "Marked %zuKB in %.3fms, %.1fMB/s\n",
+            num_bytes_marked / 1024,
+            mark_time / 1000000.0,
+            mark_time > 0 ? (num_bytes_marked / (1024.0*1024.0)) /
+                (mark_time / 1000000000.0) : 0.0);
 }
 
 } // namespace pz
@@ -77,12 +77,16 @@ class LBlock {
         const static int Empty_Free_List = -1;
         int       free_list;
 
+        // True while this block is some mutator's allocation buffer.
+        bool      owned;
+
         // Really a bytemap.
         uint8_t   bitmap[GC_Cells_Per_LBlock];
 
         explicit Header(size_t cell_size_) :
             block_type_or_size(cell_size_),
-            free_list(Empty_Free_List)
+            free_list(Empty_Free_List),
+            owned(false)
         {
             assert(cell_size_ >= GC_Min_Cell_Size);
         }
@@ -221,8 +225,18 @@ class LBlock {
         return m_header.block_type_or_size != Header::Block_Empty;
     }
 
-    // Returns true if the entire block is empty and may be reclaimed.
-    bool sweep(const Options &options);
+    bool is_owned() const {
+        return m_header.owned;
+    }
+
+    void set_owned(bool owned) {
+        assert(is_in_use());
+        m_header.owned = owned;
+    }
+
+    // Returns the number of cells still in use, if zero the entire block
+    // is empty and may be reclaimed.
+    unsigned sweep(const Options &options);
 
     void make_unused();
 
@@ -233,6 +247,9 @@ class LBlock {
 
     void check();
 
+    // Calculate the number of allocated cells via the free list length.
+    unsigned num_allocated();
+
   private:
     bool is_in_free_list(CellPtr &cell);
 
@@ -258,10 +275,21 @@ class BBlock {
   private:
     uint32_t    m_wilderness;
 
+    /*
+     * Running totals of what's in use within this BBlock.  These are
+     * updated as blocks and cells are allocated and when we sweep, so that
+     * size queries and the allocation slow path don't need to scan every
+     * LBlock.  The live cell counts are indexed by cell size in words.
+     */
+    uint32_t    m_num_lblocks_in_use;
+    size_t      m_allocated_bytes;
+    uint32_t    m_live_cells[LBlock::Max_Cell_Size + 1];
+
     alignas(GC_LBlock_Size)
     LBlock      m_blocks[GC_LBlock_Per_BBlock];
 
-    BBlock() : m_wilderness(0) { }
+    BBlock() : m_wilderness(0), m_num_lblocks_in_use(0),
+        m_allocated_bytes(0), m_live_cells{0} { }
 
     BBlock(const BBlock&) = delete;
     void operator=(const BBlock&) = delete;
@@ -277,12 +305,38 @@ class BBlock {
      */
     LBlock* allocate_block();
 
+    /*
+     * Account for cells of this size that were allocated from one of our
+     * LBlocks.
+     */
+    void cells_allocated(size_t size_in_words, unsigned num = 1) {
+        m_live_cells[size_in_words] += num;
+        m_allocated_bytes += num * size_in_words * WORDSIZE_BYTES;
+    }
+
     /*
      * The size of the allocated portion of this BBlock.
      */
-    size_t size() const;
+    size_t size() const {
+        return m_num_lblocks_in_use * GC_LBlock_Size;
+    }
+
+    bool is_empty() const {
+        return m_num_lblocks_in_use == 0;
+    }
 
-    bool is_empty() const;
+    /*
+     * The number of bytes within cells that are currently allocated.
+     * This includes cells that are no-longer reachable but havn't been
+     * swept yet.
+     */
+    size_t allocated_bytes() const {
+        return m_allocated_bytes;
+    }
+
+    unsigned live_cells(size_t size_in_words) const {
+        return m_live_cells[size_in_words];
+    }
 
     /*
      * True if this pointer lies within the allocated part of this bblock.
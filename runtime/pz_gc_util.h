@@ -39,6 +39,13 @@ class GCCapability {
     // Called by the GC if we couldn't allocate this much memory.
     virtual void oom(size_t size_bytes) = 0;
 
+    /*
+     * Mutators that own allocation buffers return them here so that the
+     * GC can allocate from them.  Everything else allocates from the
+     * shared heap.
+     */
+    virtual AllocBuffers * alloc_buffers() { return nullptr; }
+
     /*
      * This casts to AbstractGCTracer whenever can_gc() returns true, so it
      * must be the only subclass that overrides can_gc() to return true.
@@ -45,6 +45,7 @@ run(PZ &pz, const Options &options)
     assert(PZT_LAST_TOKEN < 256);
 
     Context context(pz.heap());
+    context.alloc_profile = pz.alloc_profile();
 
     /*
      * Assemble a special procedure that exits the interpreter and put its
@@ -76,15 +77,14 @@ run(PZ &pz, const Options &options)
     return retcode;
 }
 
-#define RETURN_STACK_SIZE 2048
-#define EXPR_STACK_SIZE 2048
-
 Context::Context(Heap *heap) :
         AbstractGCTracer(heap),
         ip(nullptr),
         env(nullptr),
         rsp(0),
-        esp(0)
+        esp(0),
+        alloc_profile(nullptr),
+        buffers(heap)
 {
     return_stack = new uint8_t*[RETURN_STACK_SIZE];
     expr_stack = new StackValue[EXPR_STACK_SIZE];
@@ -166,6 +166,8 @@ write_instr(uint8_t       *proc,
     PZ_WRITE_INSTR_0(PZI_CCALL, PZT_CCALL);
     PZ_WRITE_INSTR_0(PZI_CCALL_ALLOC, PZT_CCALL_ALLOC);
     PZ_WRITE_INSTR_0(PZI_CCALL_SPECIAL, PZT_CCALL_SPECIAL);
+    PZ_WRITE_INSTR_0(PZI_LOAD_PROC, PZT_LOAD_PROC);
+    PZ_WRITE_INSTR_0(PZI_CHECK_STACK, PZT_CHECK_STACK);
 
 #undef PZ_WRITE_INSTR_0
 
@@ -12,53 +12,81 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "pz_interp.h"
 
+#include "pz_array.h"
 #include "pz_gc.h"
+#include "pz_generic_ccall.h"
 #include "pz_generic_run.h"
+#include "pz_map.h"
+#include "pz_parameter.h"
+#include "pz_string.h"
 
 namespace pz {
 
+/*
+ * Builtins that allocate are given the interpreter's Context as their
+ * GC capability.  The allocation is attributed to the CCALL instruction
+ * that called the builtin, like an ALLOC instruction.  That's the call
+ * site when the call was made inline, or the builtin's own code when it
+ * was called through its closure.
+ */
+void
+profile_builtin_alloc(AbstractGCTracer &gc_trace, const char *what,
+        size_t bytes)
+{
+    Context &context = static_cast<Context&>(gc_trace);
+
+    if (context.alloc_profile) {
+        context.alloc_profile->record(context.ip, what, bytes);
+    }
+}
+
 /*
  * Imported procedures
  *
  **********************/
 
 unsigned
-pz_builtin_print_func(void *void_stack, unsigned sp)
+pz_builtin_print_func(void *void_stack, unsigned sp, PZ &pz)
 {
     StackValue *stack = static_cast<StackValue*>(void_stack);
 
-    char *string = (char *)(stack[sp--].uptr);
-    printf("%s", string);
+    const String *string = static_cast<String*>(stack[sp--].ptr);
+    pz.stdout_buffer().write(string);
     return sp;
 }
 
-/*
- * Long enough for a 32 bit value, plus a sign, plus a null termination
- * byte.
- */
-#define INT_TO_STRING_BUFFER_SIZE 11
+unsigned
+pz_builtin_flush_func(void *void_stack, unsigned sp, PZ &pz)
+{
+    pz.stdout_buffer().flush();
+    return sp;
+}
+
+unsigned
+pz_builtin_print_int_func(void *void_stack, unsigned sp, PZ &pz)
+{
+    StackValue *stack = static_cast<StackValue*>(void_stack);
+
+    pz.stdout_buffer().write_int(stack[sp--].s32);
+    return sp;
+}
 
 unsigned
 pz_builtin_int_to_string_func(void *void_stack, unsigned sp,
         AbstractGCTracer &gc_trace)
 {
-    char           *string;
-    int32_t         num;
-    int             result;
+    String         *string;
     StackValue     *stack = static_cast<StackValue*>(void_stack);
 
-    num = stack[sp].s32;
-    string = static_cast<char*>(
-        gc_trace.alloc_bytes(INT_TO_STRING_BUFFER_SIZE));
-    result = snprintf(string, INT_TO_STRING_BUFFER_SIZE, "%d", (int)num);
-    if ((result < 0) || (result > (INT_TO_STRING_BUFFER_SIZE - 1))) {
-        stack[sp].ptr = NULL;
-    } else {
-        stack[sp].ptr = string;
-    }
+    // Plasma's Int is a 32 bit fast word, from_int handles any int64_t.
+    string = String::from_int(gc_trace, stack[sp].s32);
+    profile_builtin_alloc(gc_trace, "int_to_string",
+            String::alloc_size(string->length()));
+    stack[sp].ptr = string;
     return sp;
 }
 
@@ -67,10 +95,11 @@ pz_builtin_setenv_func(void *void_stack, unsigned sp)
 {
     StackValue    *stack = static_cast<StackValue*>(void_stack);
     int            result;
-    const char    *value = static_cast<char*>(stack[sp--].ptr);
-    const char    *name = static_cast<char*>(stack[sp--].ptr);
+    const String  *value = static_cast<String*>(stack[sp--].ptr);
+    const String  *name = static_cast<String*>(stack[sp--].ptr);
 
-    result = setenv(name, value, 1);
+    result = setenv(name->to_std_string().c_str(),
+            value->to_std_string().c_str(), 1);
 
     stack[++sp].u32 = !result;
 
@@ -94,53 +123,456 @@ pz_builtin_gettimeofday_func(void *void_stack, unsigned sp)
     return sp;
 }
 
+/*
+ * Read a clock and push a success flag and the clock's value in
+ * nanoseconds, as a 64 bit word.
+ */
+static unsigned
+clock_builtin(void *void_stack, unsigned sp, clockid_t clock)
+{
+    StackValue     *stack = static_cast<StackValue*>(void_stack);
+    struct timespec ts;
+    int             res;
+
+    res = clock_gettime(clock, &ts);
+
+    stack[++sp].u32 = res == 0 ? 1 : 0;
+    stack[++sp].s64 = res == 0 ?
+        int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec : 0;
+
+    return sp;
+}
+
+unsigned
+pz_builtin_monotonic_ns_func(void *void_stack, unsigned sp)
+{
+    return clock_builtin(void_stack, sp, CLOCK_MONOTONIC);
+}
+
+unsigned
+pz_builtin_cpu_time_ns_func(void *void_stack, unsigned sp)
+{
+    return clock_builtin(void_stack, sp, CLOCK_PROCESS_CPUTIME_ID);
+}
+
+unsigned
+pz_builtin_thread_cpu_time_ns_func(void *void_stack, unsigned sp)
+{
+    return clock_builtin(void_stack, sp, CLOCK_THREAD_CPUTIME_ID);
+}
+
 unsigned
 pz_builtin_concat_string_func(void *void_stack, unsigned sp,
         AbstractGCTracer &gc_trace)
 {
-    const char     *s1, *s2;
-    char           *s;
-    size_t          len;
+    String         *s1, *s2;
+    String         *s;
     StackValue     *stack = static_cast<StackValue*>(void_stack);
 
-    s2 = (const char *)stack[sp--].ptr;
-    s1 = (const char *)stack[sp].ptr;
+    s2 = static_cast<String*>(stack[sp--].ptr);
+    s1 = static_cast<String*>(stack[sp].ptr);
 
-    len = strlen(s1) + strlen(s2) + 1;
-    s = static_cast<char*>(gc_trace.alloc_bytes(sizeof(char) * len));
-    strcpy(s, s1);
-    strcat(s, s2);
+    if (s1->length() > String::Max_Length - s2->length()) {
+        fprintf(stderr, "String too long\n");
+        abort();
+    }
+    s = String::concat(gc_trace, s1, s2);
+    if (s != s1 && s != s2) {
+        profile_builtin_alloc(gc_trace, "concat_string", s->is_rope() ?
+                String::rope_alloc_size() : String::alloc_size(s->length()));
+    }
 
     stack[sp].ptr = s;
     return sp;
 }
 
 unsigned
-pz_builtin_die_func(void *void_stack, unsigned sp)
+pz_builtin_flatten_string_func(void *void_stack, unsigned sp,
+        AbstractGCTracer &gc_trace)
 {
-    const char     *s;
     StackValue     *stack = static_cast<StackValue*>(void_stack);
+    String         *s = static_cast<String*>(stack[sp].ptr);
 
-    s = (const char *)stack[sp].ptr;
-    fprintf(stderr, "Die: %s\n", s);
-    exit(1);
+    if (!s->is_flat()) {
+        profile_builtin_alloc(gc_trace, "flatten_string",
+                String::alloc_size(s->length()));
+    }
+    s = s->flatten(gc_trace);
+
+    stack[sp].ptr = s;
+    return sp;
+}
+
+/*
+ * Arrays
+ *********/
+
+static void
+array_bounds_error(const char *builtin, const Array *array,
+        uint32_t start, uint32_t count)
+{
+    fprintf(stderr, "%s: elements %u to %u are out of bounds for an array "
+            "of length %u\n", builtin, (unsigned)start,
+            (unsigned)(start + count), (unsigned)array->length());
+    abort();
+}
+
+static void
+array_check_mutable(const char *builtin, const Array *array)
+{
+    if (array->is_constant()) {
+        fprintf(stderr, "%s: Can't modify a constant array\n", builtin);
+        abort();
+    }
+}
+
+static void
+array_read_elem(const void *elem, unsigned elem_size, StackValue &dest)
+{
+    switch (elem_size) {
+        case 1: dest.u8 = *static_cast<const uint8_t*>(elem); break;
+        case 2: dest.u16 = *static_cast<const uint16_t*>(elem); break;
+        case 4: dest.u32 = *static_cast<const uint32_t*>(elem); break;
+        case 8: dest.u64 = *static_cast<const uint64_t*>(elem); break;
+        default: abort();
+    }
+}
+
+static void
+array_write_elem(void *elem, unsigned elem_size, const StackValue &value)
+{
+    switch (elem_size) {
+        case 1: *static_cast<uint8_t*>(elem) = value.u8; break;
+        case 2: *static_cast<uint16_t*>(elem) = value.u16; break;
+        case 4: *static_cast<uint32_t*>(elem) = value.u32; break;
+        case 8: *static_cast<uint64_t*>(elem) = value.u64; break;
+        default: abort();
+    }
 }
 
 unsigned
-pz_builtin_set_parameter_func(void *void_stack, unsigned sp, PZ &pz)
+pz_builtin_array_new_func(void *void_stack, unsigned sp,
+        AbstractGCTracer &gc_trace)
 {
     StackValue *stack = static_cast<StackValue*>(void_stack);
 
-    int32_t value = stack[sp].s32;
-    const char *name = (const char *)stack[sp-1].ptr;
-    int32_t result;
+    uint32_t length = stack[sp--].u32;
+    unsigned elem_size = stack[sp].u32;
+    if (!Array::valid_elem_size(elem_size)) {
+        fprintf(stderr, "array_new: Invalid element size %u\n", elem_size);
+        abort();
+    }
+
+    Array *array = Array::alloc(gc_trace, elem_size, length);
+    profile_builtin_alloc(gc_trace, "array_new",
+            Array::alloc_size(elem_size, length));
+    stack[sp].ptr = array;
+    return sp;
+}
+
+static uint32_t
+array_length(Array *array)
+{
+    return array->length();
+}
+
+unsigned
+pz_builtin_array_length_func(void *stack, unsigned sp)
+{
+    return typed_ccall(array_length, stack, sp);
+}
+
+unsigned
+pz_builtin_array_load_func(void *void_stack, unsigned sp)
+{
+    StackValue *stack = static_cast<StackValue*>(void_stack);
+
+    uint32_t index = stack[sp--].u32;
+    Array *array = static_cast<Array*>(stack[sp].ptr);
+    if (!array->in_bounds(index, 1)) {
+        array_bounds_error("array_load", array, index, 1);
+    }
+
+    array_read_elem(array->element(index), array->elem_size(), stack[sp]);
+    return sp;
+}
+
+unsigned
+pz_builtin_array_store_func(void *void_stack, unsigned sp)
+{
+    StackValue *stack = static_cast<StackValue*>(void_stack);
+
+    const StackValue &value = stack[sp--];
+    uint32_t index = stack[sp--].u32;
+    Array *array = static_cast<Array*>(stack[sp--].ptr);
+    array_check_mutable("array_store", array);
+    if (!array->in_bounds(index, 1)) {
+        array_bounds_error("array_store", array, index, 1);
+    }
+
+    array_write_elem(array->element(index), array->elem_size(), value);
+    return sp;
+}
+
+unsigned
+pz_builtin_array_copy_func(void *void_stack, unsigned sp)
+{
+    StackValue *stack = static_cast<StackValue*>(void_stack);
+
+    uint32_t count = stack[sp--].u32;
+    uint32_t src_start = stack[sp--].u32;
+    Array *src = static_cast<Array*>(stack[sp--].ptr);
+    uint32_t dest_start = stack[sp--].u32;
+    Array *dest = static_cast<Array*>(stack[sp--].ptr);
+
+    array_check_mutable("array_copy", dest);
+    if (src->elem_size() != dest->elem_size()) {
+        fprintf(stderr, "array_copy: Element sizes differ (%u and %u)\n",
+                src->elem_size(), dest->elem_size());
+        abort();
+    }
+    if (!src->in_bounds(src_start, count)) {
+        array_bounds_error("array_copy", src, src_start, count);
+    }
+    if (!dest->in_bounds(dest_start, count)) {
+        array_bounds_error("array_copy", dest, dest_start, count);
+    }
+    if (count == 0) return sp;
+
+    // The arrays may be the same array.
+    memmove(dest->element(dest_start), src->element(src_start),
+            size_t(count) * dest->elem_size());
+    return sp;
+}
+
+unsigned
+pz_builtin_array_fill_func(void *void_stack, unsigned sp)
+{
+    StackValue *stack = static_cast<StackValue*>(void_stack);
+
+    const StackValue &value = stack[sp--];
+    uint32_t count = stack[sp--].u32;
+    uint32_t start = stack[sp--].u32;
+    Array *array = static_cast<Array*>(stack[sp--].ptr);
+    array_check_mutable("array_fill", array);
+    if (!array->in_bounds(start, count)) {
+        array_bounds_error("array_fill", array, start, count);
+    }
+    if (count == 0) return sp;
+
+    unsigned elem_size = array->elem_size();
+    uint8_t *elem = static_cast<uint8_t*>(array->element(start));
+    if (elem_size == 1) {
+        memset(elem, value.u8, count);
+    } else {
+        for (uint32_t i = 0; i < count; i++) {
+            array_write_elem(elem, elem_size, value);
+            elem += elem_size;
+        }
+    }
+    return sp;
+}
+
+/*
+ * Read a map key from the stack.  Integer keys are fast words.  String
+ * keys are flattened and the flat string is written back to the stack so
+ * that it stays reachable while the map allocates.
+ */
+static uintptr_t
+map_key_arg(Map *map, StackValue &value, AbstractGCTracer &gc_trace,
+        const char *what)
+{
+    if (map->key_kind() == Map::INT_KEYS) {
+        return uintptr_t(intptr_t(value.s32));
+    }
+
+    String *string = static_cast<String*>(value.ptr);
+    if (!string->is_flat()) {
+        profile_builtin_alloc(gc_trace, what,
+                String::alloc_size(string->length()));
+    }
+    string = string->flatten(gc_trace);
+    if (!string) {
+        fprintf(stderr, "%s: Out of memory\n", what);
+        abort();
+    }
+    value.ptr = string;
+    return reinterpret_cast<uintptr_t>(string);
+}
 
-    if (0 == strcmp(name, "heap_max_size")) {
-        result = heap_set_max_size(pz.heap(), value);
+static void
+map_write_key(Map *map, uintptr_t key, StackValue &value)
+{
+    if (map->key_kind() == Map::INT_KEYS) {
+        value.sptr = intptr_t(key);
     } else {
-        fprintf(stderr, "No such parameter '%s'\n", name);
-        result = 0;
+        value.ptr = reinterpret_cast<void*>(key);
+    }
+}
+
+static uint32_t
+map_slot_arg(Map *map, const StackValue &value, const char *what)
+{
+    uint32_t slot = value.u32;
+    if (!map->holds_key(slot)) {
+        fprintf(stderr, "%s: Slot %u doesn't hold a key\n", what, slot);
+        abort();
+    }
+    return slot;
+}
+
+unsigned
+pz_builtin_map_new_func(void *void_stack, unsigned sp,
+        AbstractGCTracer &gc_trace)
+{
+    StackValue *stack = static_cast<StackValue*>(void_stack);
+
+    uint32_t key_kind = stack[sp].u32;
+    if (!Map::valid_key_kind(key_kind)) {
+        fprintf(stderr, "map_new: Invalid key kind %u\n", key_kind);
+        abort();
+    }
+
+    profile_builtin_alloc(gc_trace, "map_new", sizeof(Map));
+    stack[sp].ptr = Map::alloc(gc_trace, Map::KeyKind(key_kind));
+    return sp;
+}
+
+static uint32_t
+map_size(Map *map)
+{
+    return map->size();
+}
+
+unsigned
+pz_builtin_map_size_func(void *stack, unsigned sp)
+{
+    return typed_ccall(map_size, stack, sp);
+}
+
+unsigned
+pz_builtin_map_set_func(void *void_stack, unsigned sp,
+        AbstractGCTracer &gc_trace)
+{
+    StackValue *stack = static_cast<StackValue*>(void_stack);
+    Map        *map = static_cast<Map*>(stack[sp-2].ptr);
+
+    uintptr_t key = map_key_arg(map, stack[sp-1], gc_trace, "map_set");
+    if (!map->insert(gc_trace, key, stack[sp].uptr)) {
+        fprintf(stderr, "map_set: Map is full or out of memory "
+                "(%u entries)\n", map->size());
+        abort();
     }
+    return sp - 3;
+}
+
+unsigned
+pz_builtin_map_get_func(void *void_stack, unsigned sp,
+        AbstractGCTracer &gc_trace)
+{
+    StackValue *stack = static_cast<StackValue*>(void_stack);
+    Map        *map = static_cast<Map*>(stack[sp-1].ptr);
+
+    uintptr_t key = map_key_arg(map, stack[sp], gc_trace, "map_get");
+    uintptr_t value = 0;
+    bool found = map->lookup(key, &value);
+
+    stack[sp-1].uptr = value;
+    stack[sp].sptr = found;
+    return sp;
+}
+
+unsigned
+pz_builtin_map_remove_func(void *void_stack, unsigned sp,
+        AbstractGCTracer &gc_trace)
+{
+    StackValue *stack = static_cast<StackValue*>(void_stack);
+    Map        *map = static_cast<Map*>(stack[sp-1].ptr);
+
+    uintptr_t key = map_key_arg(map, stack[sp], gc_trace, "map_remove");
+    sp--;
+    stack[sp].sptr = map->remove(key);
+    return sp;
+}
+
+static int32_t
+map_next(Map *map, int32_t pos)
+{
+    return map->next(pos);
+}
+
+unsigned
+pz_builtin_map_next_func(void *stack, unsigned sp)
+{
+    return typed_ccall(map_next, stack, sp);
+}
+
+unsigned
+pz_builtin_map_key_func(void *void_stack, unsigned sp)
+{
+    StackValue *stack = static_cast<StackValue*>(void_stack);
+
+    Map *map = static_cast<Map*>(stack[sp-1].ptr);
+    uint32_t slot = map_slot_arg(map, stack[sp], "map_key");
+    sp--;
+    map_write_key(map, map->key_at(slot), stack[sp]);
+    return sp;
+}
+
+unsigned
+pz_builtin_map_value_func(void *void_stack, unsigned sp)
+{
+    StackValue *stack = static_cast<StackValue*>(void_stack);
+
+    Map *map = static_cast<Map*>(stack[sp-1].ptr);
+    uint32_t slot = map_slot_arg(map, stack[sp], "map_value");
+    sp--;
+    stack[sp].uptr = map->value_at(slot);
+    return sp;
+}
+
+unsigned
+pz_builtin_die_func(void *void_stack, unsigned sp, PZ &pz)
+{
+    const String   *s;
+    StackValue     *stack = static_cast<StackValue*>(void_stack);
+
+    // Output printed before the program died must not be lost.
+    pz.stdout_buffer().flush();
+
+    s = static_cast<String*>(stack[sp].ptr);
+    fputs("Die: ", stderr);
+    s->for_each_piece([](const char *bytes, uint32_t len) {
+        fwrite(bytes, 1, len, stderr);
+    });
+    fputs("\n", stderr);
+    exit(1);
+}
+
+/*
+ * Look up a parameter by name, printing a message if there's no such
+ * parameter.
+ */
+static Optional<ParameterId>
+parameter_arg(const StackValue &value)
+{
+    String *name = static_cast<String*>(value.ptr);
+    Optional<ParameterId> id = parameter_lookup(name);
+    if (!id.hasValue()) {
+        fprintf(stderr, "No such parameter '%s'\n",
+                name->to_std_string().c_str());
+    }
+    return id;
+}
+
+unsigned
+pz_builtin_set_parameter_func(void *void_stack, unsigned sp, PZ &pz)
+{
+    StackValue *stack = static_cast<StackValue*>(void_stack);
+
+    int32_t value = stack[sp].s32;
+    Optional<ParameterId> id = parameter_arg(stack[sp-1]);
+    int32_t result = id.hasValue() && parameter_set(pz, id.value(), value);
 
     sp--;
     stack[sp].sptr = result;
@@ -153,23 +585,18 @@ pz_builtin_get_parameter_func(void *void_stack, unsigned sp, PZ &pz)
 {
     StackValue *stack = static_cast<StackValue*>(void_stack);
 
-    const char *name = (const char *)stack[sp].ptr;
-    int32_t result;
-    int32_t value;
-
-    if (0 == strcmp(name, "heap_size")) {
-        value = heap_get_size(pz.heap());
-        result = 1;
-    } else if (0 == strcmp(name, "heap_max_size")) {
-        value = heap_get_max_size(pz.heap());
-        result = 1;
-    } else if (0 == strcmp(name, "heap_collections")) {
-        value = heap_get_collections(pz.heap());
-        result = 1;
-    } else {
-        fprintf(stderr, "No such parameter '%s'.\n", name);
-        result = 0;
-        value = 0;
+    Optional<ParameterId> id = parameter_arg(stack[sp]);
+    int32_t result = 0;
+    int32_t value = 0;
+
+    if (id.hasValue()) {
+        // Values that don't fit in a fast word can only be read with
+        // get_parameter_by_id.
+        int64_t value64 = parameter_get(pz, id.value());
+        if (value64 >= INT32_MIN && value64 <= INT32_MAX) {
+            value = value64;
+            result = 1;
+        }
     }
 
     stack[sp].sptr = result;
@@ -179,5 +606,50 @@ pz_builtin_get_parameter_func(void *void_stack, unsigned sp, PZ &pz)
     return sp;
 }
 
+static int32_t
+parameter_id(String *name)
+{
+    Optional<ParameterId> id = parameter_lookup(name);
+    return id.hasValue() ? int32_t(id.value()) : -1;
+}
+
+unsigned
+pz_builtin_parameter_id_func(void *stack, unsigned sp)
+{
+    return typed_ccall(parameter_id, stack, sp);
+}
+
+static ParameterId
+parameter_id_arg(const StackValue &value, const char *what)
+{
+    ParameterId id = value.u32;
+    if (!parameter_valid(id)) {
+        fprintf(stderr, "%s: Invalid parameter ID %u\n", what, id);
+        abort();
+    }
+    return id;
+}
+
+unsigned
+pz_builtin_set_parameter_by_id_func(void *void_stack, unsigned sp, PZ &pz)
+{
+    StackValue *stack = static_cast<StackValue*>(void_stack);
+
+    int64_t value = stack[sp--].s64;
+    ParameterId id = parameter_id_arg(stack[sp], "set_parameter_by_id");
+    stack[sp].sptr = parameter_set(pz, id, value);
+    return sp;
+}
+
+unsigned
+pz_builtin_get_parameter_by_id_func(void *void_stack, unsigned sp, PZ &pz)
+{
+    StackValue *stack = static_cast<StackValue*>(void_stack);
+
+    ParameterId id = parameter_id_arg(stack[sp], "get_parameter_by_id");
+    stack[sp].s64 = parameter_get(pz, id);
+    return sp;
+}
+
 } // namespace pz
 
@@ -0,0 +1,418 @@
+/*
+ * Plasma string builtins (generic portable version)
+ * vim: ts=4 sw=4 et
+ *
+ * Copyright (C) 2019 Plasma Team
+ * Distributed under the terms of the MIT license, see ../LICENSE.code
+ *
+ * The byte comparison and searching loops have SSE2 and AVX2 versions,
+ * which version is used is decided once by checking what the CPU
+ * supports.  Other architectures use the scalar versions, which are built
+ * on libc's memcmp and memchr.
+ */
+
+#include "pz_common.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define PZ_STRING_X86 1
+#include <immintrin.h>
+#endif
+
+#include "pz_interp.h"
+
+#include "pz_generic_ccall.h"
+#include "pz_generic_run.h"
+#include "pz_string.h"
+
+namespace pz {
+
+/*
+ * Byte-level operations
+ *
+ ************************/
+
+struct StringOps {
+    // True if the n bytes at a and b are the same.
+    bool (*equal)(const char *a, const char *b, size_t n);
+
+    // Compare n bytes as unsigned, with the same result as memcmp.
+    int (*compare)(const char *a, const char *b, size_t n);
+
+    // Find the first occurrence of needle within haystack, or return
+    // null.  needle_len is at least 2 and no more than haystack_len.
+    const char * (*find)(const char *haystack, size_t haystack_len,
+            const char *needle, size_t needle_len);
+};
+
+#ifndef PZ_STRING_X86
+static bool
+equal_scalar(const char *a, const char *b, size_t n)
+{
+    return memcmp(a, b, n) == 0;
+}
+
+static int
+compare_scalar(const char *a, const char *b, size_t n)
+{
+    return memcmp(a, b, n);
+}
+#endif
+
+// The SIMD searches finish with this.
+static const char *
+find_scalar(const char *haystack, size_t haystack_len,
+        const char *needle, size_t needle_len)
+{
+    const char *last = haystack + (haystack_len - needle_len);
+    const char *cur = haystack;
+
+    while (cur <= last) {
+        cur = static_cast<const char*>(
+                memchr(cur, needle[0], last - cur + 1));
+        if (!cur) return nullptr;
+        if (memcmp(cur + 1, needle + 1, needle_len - 1) == 0) {
+            return cur;
+        }
+        cur++;
+    }
+
+    return nullptr;
+}
+
+/*
+ * The result of comparing the first differing byte, at offset within a
+ * and b.
+ */
+static inline int
+compare_at(const char *a, const char *b, size_t offset)
+{
+    return int(uint8_t(a[offset])) - int(uint8_t(b[offset]));
+}
+
+#ifdef PZ_STRING_X86
+
+/*
+ * SSE2 is part of x86-64 so these need no check.
+ *
+ * The search compares each block of the haystack against the needle's
+ * first byte, and the block needle_len - 1 bytes further on against its
+ * last byte.  Only the positions where both match are compared in full.
+ */
+
+static bool
+equal_sse2(const char *a, const char *b, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(b + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xFFFF) {
+            return false;
+        }
+    }
+
+    return memcmp(a + i, b + i, n - i) == 0;
+}
+
+static int
+compare_sse2(const char *a, const char *b, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(b + i));
+        unsigned diff =
+            ~unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb))) & 0xFFFF;
+        if (diff) {
+            return compare_at(a, b, i + __builtin_ctz(diff));
+        }
+    }
+
+    return memcmp(a + i, b + i, n - i);
+}
+
+static const char *
+find_sse2(const char *haystack, size_t haystack_len,
+        const char *needle, size_t needle_len)
+{
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+    // The number of positions the needle could start at.
+    size_t positions = haystack_len - needle_len + 1;
+    size_t i = 0;
+
+    for (; i + 16 <= positions; i += 16) {
+        __m128i block_first = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(haystack + i));
+        __m128i block_last = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(
+                    haystack + i + needle_len - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+                    _mm_cmpeq_epi8(first, block_first),
+                    _mm_cmpeq_epi8(last, block_last)));
+        while (mask) {
+            size_t pos = i + __builtin_ctz(mask);
+            if (memcmp(haystack + pos + 1, needle + 1, needle_len - 2) == 0)
+            {
+                return haystack + pos;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return find_scalar(haystack + i, haystack_len - i, needle, needle_len);
+}
+
+__attribute__((target("avx2")))
+static bool
+equal_avx2(const char *a, const char *b, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(b + i));
+        if (unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb))) !=
+                0xFFFFFFFFu)
+        {
+            return false;
+        }
+    }
+
+    return equal_sse2(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static int
+compare_avx2(const char *a, const char *b, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(b + i));
+        unsigned diff =
+            ~unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)));
+        if (diff) {
+            return compare_at(a, b, i + __builtin_ctz(diff));
+        }
+    }
+
+    return compare_sse2(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static const char *
+find_avx2(const char *haystack, size_t haystack_len,
+        const char *needle, size_t needle_len)
+{
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+    size_t positions = haystack_len - needle_len + 1;
+    size_t i = 0;
+
+    for (; i + 32 <= positions; i += 32) {
+        __m256i block_first = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(haystack + i));
+        __m256i block_last = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(
+                    haystack + i + needle_len - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(
+                    _mm256_cmpeq_epi8(first, block_first),
+                    _mm256_cmpeq_epi8(last, block_last)));
+        while (mask) {
+            size_t pos = i + __builtin_ctz(mask);
+            if (memcmp(haystack + pos + 1, needle + 1, needle_len - 2) == 0)
+            {
+                return haystack + pos;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return find_sse2(haystack + i, haystack_len - i, needle, needle_len);
+}
+
+#endif // PZ_STRING_X86
+
+static StringOps
+select_string_ops()
+{
+#ifdef PZ_STRING_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return StringOps { equal_avx2, compare_avx2, find_avx2 };
+    }
+    return StringOps { equal_sse2, compare_sse2, find_sse2 };
+#else
+    return StringOps { equal_scalar, compare_scalar, find_scalar };
+#endif
+}
+
+static const StringOps &
+string_ops()
+{
+    static const StringOps ops = select_string_ops();
+    return ops;
+}
+
+/*
+ * Returns the index of needle within haystack or -1.
+ */
+static int64_t
+find_bytes(const char *haystack, size_t haystack_len,
+        const char *needle, size_t needle_len)
+{
+    if (needle_len == 0) return 0;
+    if (needle_len > haystack_len) return -1;
+
+    const char *found;
+    if (needle_len == 1) {
+        found = static_cast<const char*>(
+                memchr(haystack, needle[0], haystack_len));
+    } else {
+        found = string_ops().find(haystack, haystack_len, needle,
+                needle_len);
+    }
+
+    return found ? found - haystack : -1;
+}
+
+/*
+ * Builtins
+ *
+ ***********/
+
+/*
+ * Ropes are flattened so their bytes can be compared in one place.  The
+ * rope remembers its flat version so this only copies a rope once.
+ */
+static String *
+flat_arg(const StackValue &value, AbstractGCTracer &gc_trace,
+        const char *what)
+{
+    String *string = static_cast<String*>(value.ptr);
+
+    if (!string->is_flat()) {
+        profile_builtin_alloc(gc_trace, what,
+                String::alloc_size(string->length()));
+    }
+    return string->flatten(gc_trace);
+}
+
+unsigned
+pz_builtin_string_equals_func(void *void_stack, unsigned sp,
+        AbstractGCTracer &gc_trace)
+{
+    StackValue *stack = static_cast<StackValue*>(void_stack);
+    String     *s1 = static_cast<String*>(stack[sp-1].ptr);
+    String     *s2 = static_cast<String*>(stack[sp].ptr);
+    bool        result;
+
+    if (s1 == s2) {
+        result = true;
+    } else if (s1->length() != s2->length()) {
+        result = false;
+    } else if (s1->known_hash() && s2->known_hash() &&
+            s1->known_hash() != s2->known_hash())
+    {
+        result = false;
+    } else {
+        s1 = flat_arg(stack[sp-1], gc_trace, "string_equals");
+        s2 = flat_arg(stack[sp], gc_trace, "string_equals");
+        result = string_ops().equal(s1->c_str(), s2->c_str(),
+                s1->length());
+    }
+
+    sp--;
+    stack[sp].sptr = result;
+    return sp;
+}
+
+unsigned
+pz_builtin_string_compare_func(void *void_stack, unsigned sp,
+        AbstractGCTracer &gc_trace)
+{
+    StackValue *stack = static_cast<StackValue*>(void_stack);
+    String     *s1 = flat_arg(stack[sp-1], gc_trace, "string_compare");
+    String     *s2 = flat_arg(stack[sp], gc_trace, "string_compare");
+    uint32_t    len1 = s1->length();
+    uint32_t    len2 = s2->length();
+
+    int result = string_ops().compare(s1->c_str(), s2->c_str(),
+            std::min(len1, len2));
+    if (result == 0) {
+        result = len1 < len2 ? -1 : (len1 > len2 ? 1 : 0);
+    }
+
+    sp--;
+    stack[sp].sptr = result < 0 ? -1 : (result > 0 ? 1 : 0);
+    return sp;
+}
+
+unsigned
+pz_builtin_string_find_func(void *void_stack, unsigned sp,
+        AbstractGCTracer &gc_trace)
+{
+    StackValue *stack = static_cast<StackValue*>(void_stack);
+    String     *haystack = flat_arg(stack[sp-1], gc_trace, "string_find");
+    String     *needle = flat_arg(stack[sp], gc_trace, "string_find");
+
+    sp--;
+    stack[sp].sptr = find_bytes(haystack->c_str(), haystack->length(),
+            needle->c_str(), needle->length());
+    return sp;
+}
+
+unsigned
+pz_builtin_string_starts_with_func(void *void_stack, unsigned sp,
+        AbstractGCTracer &gc_trace)
+{
+    StackValue *stack = static_cast<StackValue*>(void_stack);
+    String     *string = static_cast<String*>(stack[sp-1].ptr);
+    String     *prefix = static_cast<String*>(stack[sp].ptr);
+    bool        result;
+
+    if (prefix->length() > string->length()) {
+        result = false;
+    } else {
+        string = flat_arg(stack[sp-1], gc_trace, "string_starts_with");
+        prefix = flat_arg(stack[sp], gc_trace, "string_starts_with");
+        result = string_ops().equal(string->c_str(), prefix->c_str(),
+                prefix->length());
+    }
+
+    sp--;
+    stack[sp].sptr = result;
+    return sp;
+}
+
+static uint32_t
+string_hash(String *string)
+{
+    // Constants' hashes were computed as they were loaded, so this never
+    // writes to read-only data.
+    return string->hash();
+}
+
+unsigned
+pz_builtin_string_hash_func(void *stack, unsigned sp)
+{
+    return typed_ccall(string_hash, stack, sp);
+}
+
+} // namespace pz
@@ -0,0 +1,130 @@
+/*
+ * Plasma bytecode generic interpreter typed builtin calls
+ * vim: ts=4 sw=4 et
+ *
+ * Copyright (C) 2019 Plasma Team
+ * Distributed under the terms of the MIT license, see ../LICENSE.code
+ */
+
+#ifndef PZ_GENERIC_CCALL_H
+#define PZ_GENERIC_CCALL_H
+
+#include "pz_generic_run.h"
+
+namespace pz {
+
+/*
+ * Builtins that take and return simple values can be written as ordinary
+ * C++ functions and called through typed_ccall, which reads each argument
+ * from the expression stack according to its type and pushes the result.
+ *
+ *   static uint32_t
+ *   array_length(Array *array) { return array->length(); }
+ *
+ *   unsigned
+ *   pz_builtin_array_length_func(void *stack, unsigned sp)
+ *   {
+ *       return typed_ccall(array_length, stack, sp);
+ *   }
+ *
+ * The function is known at compile time so it's normally inlined into
+ * the builtin.
+ */
+
+/*
+ * How each type is stored in a stack slot.  Fast words are int32_t or
+ * uint32_t, results are written to the whole slot.
+ */
+template<typename T>
+struct StackArg;
+
+template<>
+struct StackArg<int32_t> {
+    static int32_t get(const StackValue &value) { return value.s32; }
+    static void put(StackValue &slot, int32_t value) { slot.sptr = value; }
+};
+
+template<>
+struct StackArg<uint32_t> {
+    static uint32_t get(const StackValue &value) { return value.u32; }
+    static void put(StackValue &slot, uint32_t value) { slot.uptr = value; }
+};
+
+template<>
+struct StackArg<int64_t> {
+    static int64_t get(const StackValue &value) { return value.s64; }
+    static void put(StackValue &slot, int64_t value) { slot.s64 = value; }
+};
+
+template<>
+struct StackArg<uint64_t> {
+    static uint64_t get(const StackValue &value) { return value.u64; }
+    static void put(StackValue &slot, uint64_t value) { slot.u64 = value; }
+};
+
+template<>
+struct StackArg<bool> {
+    static bool get(const StackValue &value) { return value.u32 != 0; }
+    static void put(StackValue &slot, bool value) { slot.sptr = value; }
+};
+
+template<typename T>
+struct StackArg<T*> {
+    static T * get(const StackValue &value) {
+        return static_cast<T*>(value.ptr);
+    }
+    static void put(StackValue &slot, T *value) { slot.ptr = value; }
+};
+
+/*
+ * The indexes of a function's arguments, C++11 doesn't have
+ * std::index_sequence.
+ */
+template<unsigned... Is>
+struct ArgIndices {};
+
+template<unsigned N, unsigned... Is>
+struct MakeArgIndices : MakeArgIndices<N - 1, N - 1, Is...> {};
+
+template<unsigned... Is>
+struct MakeArgIndices<0, Is...> {
+    typedef ArgIndices<Is...> type;
+};
+
+template<typename R>
+struct TypedCCall {
+    template<typename... Args, unsigned... Is>
+    static unsigned call(R (*func)(Args...), StackValue *stack, unsigned sp,
+            ArgIndices<Is...>)
+    {
+        // The first argument is the deepest on the stack.
+        unsigned base = sp + 1 - sizeof...(Args);
+        R result = func(StackArg<Args>::get(stack[base + Is])...);
+        StackArg<R>::put(stack[base], result);
+        return base;
+    }
+};
+
+template<>
+struct TypedCCall<void> {
+    template<typename... Args, unsigned... Is>
+    static unsigned call(void (*func)(Args...), StackValue *stack,
+            unsigned sp, ArgIndices<Is...>)
+    {
+        unsigned base = sp + 1 - sizeof...(Args);
+        func(StackArg<Args>::get(stack[base + Is])...);
+        return base - 1;
+    }
+};
+
+template<typename R, typename... Args>
+inline unsigned
+typed_ccall(R (*func)(Args...), void *stack, unsigned sp)
+{
+    return TypedCCall<R>::call(func, static_cast<StackValue*>(stack), sp,
+            typename MakeArgIndices<sizeof...(Args)>::type());
+}
+
+} // namespace pz
+
+#endif // ! PZ_GENERIC_CCALL_H
@@ -30,6 +30,12 @@ class Closure : public GCNew {
         m_data = data;
     }
 
+    /*
+     * Point the closure at new code for the same procedure, see
+     * LazyLoader.
+     */
+    void set_code(void *code) { m_code = code; }
+
     void* code() const { return m_code; }
     void* data() const { return m_data; }
 };
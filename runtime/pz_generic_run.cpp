@@ -10,6 +10,7 @@
 
 #include "pz_gc.h"
 #include "pz_interp.h"
+#include "pz_read.h"
 #include "pz_trace.h"
 #include "pz_util.h"
 
@@ -444,6 +445,9 @@ generic_main_loop(Context &context,
                 // up and convert it to words rather than bytes.
                 addr = context.alloc(
                         (size+WORDSIZE_BYTES-1) / WORDSIZE_BYTES);
+                if (context.alloc_profile) {
+                    context.alloc_profile->record(context.ip, "alloc", size);
+                }
                 context.expr_stack[++context.esp].ptr = addr;
                 pz_trace_instr(context.rsp, "alloc");
                 break;
@@ -458,6 +462,10 @@ generic_main_loop(Context &context,
                 data = context.expr_stack[context.esp].ptr;
                 Closure *closure = new(context)
                     Closure(static_cast<uint8_t*>(code), data);
+                if (context.alloc_profile) {
+                    context.alloc_profile->record(context.ip,
+                            "make_closure", sizeof(Closure));
+                }
                 context.expr_stack[context.esp].ptr = closure;
                 pz_trace_instr(context.rsp, "make_closure");
                 break;
@@ -644,6 +652,35 @@ generic_main_loop(Context &context,
                 pz_trace_instr(context.rsp, "ccall");
                 break;
             }
+            case PZT_LOAD_PROC: {
+                LazyProc *proc;
+                context.ip = (uint8_t *)AlignUp((size_t)context.ip,
+                        WORDSIZE_BYTES);
+                proc = *(LazyProc **)context.ip;
+                context.ip = proc->loader->load(*proc, context);
+                if (!context.ip) {
+                    fprintf(stderr, "Couldn't load procedure %u\n",
+                            proc->id);
+                    abort();
+                }
+                pz_trace_instr(context.rsp, "load_proc");
+                break;
+            }
+            case PZT_CHECK_STACK: {
+                uint32_t depth;
+                context.ip = (uint8_t *)AlignUp((size_t)context.ip, 4);
+                depth = *(uint32_t *)context.ip;
+                context.ip += 4;
+                if (context.esp + depth + EXPR_STACK_SLACK >=
+                            EXPR_STACK_SIZE ||
+                        context.rsp + 2 >= RETURN_STACK_SIZE)
+                {
+                    fprintf(stderr, "Stack overflow\n");
+                    abort();
+                }
+                pz_trace_instr2(context.rsp, "check_stack", depth);
+                break;
+            }
 #ifdef PZ_DEV
             case PZT_INVALID_TOKEN:
                 fprintf(stderr, "Attempt to execute poisoned memory\n");
@@ -140,7 +140,9 @@ enum InstructionToken {
     PZT_CCALL,              // Not part of PZ format.
     PZT_CCALL_ALLOC,        // Not part of PZ format.
     PZT_CCALL_SPECIAL,      // Not part of PZ format.
-    PZT_LAST_TOKEN = PZT_CCALL_ALLOC,
+    PZT_LOAD_PROC,          // Not part of PZ format.
+    PZT_CHECK_STACK,        // Not part of PZ format.
+    PZT_LAST_TOKEN = PZT_CHECK_STACK,
 #ifdef PZ_DEV
     PZT_INVALID_TOKEN = 0xF0,
 #endif
@@ -160,6 +162,15 @@ union StackValue {
     void *    ptr;
 };
 
+#define RETURN_STACK_SIZE 2048
+#define EXPR_STACK_SIZE 2048
+
+/*
+ * Builtins don't check the stack themselves, PZT_CHECK_STACK leaves this
+ * much room for their results.
+ */
+#define EXPR_STACK_SLACK 8
+
 struct Context : public AbstractGCTracer {
     uint8_t           *ip;
     void              *env;
@@ -168,12 +179,26 @@ struct Context : public AbstractGCTracer {
     StackValue        *expr_stack;
     unsigned           esp;
 
+    // Non-null when allocation profiling is enabled.
+    AllocProfile      *alloc_profile;
+
+    AllocBuffers       buffers;
+
     Context(Heap *heap);
     virtual ~Context();
 
+    virtual AllocBuffers * alloc_buffers() { return &buffers; }
+
     virtual void do_trace(HeapMarkState *state) const;
 };
 
+/*
+ * Record an allocation made by a builtin for the allocation profiler.
+ */
+void
+profile_builtin_alloc(AbstractGCTracer &gc_trace, const char *what,
+        size_t bytes);
+
 int
 generic_main_loop(Context   &context,
                   Heap      *heap,
@@ -0,0 +1,540 @@
+/*
+ * Plasma linked module images
+ * vim: ts=4 sw=4 et
+ *
+ * Copyright (C) 2019 Plasma Team
+ * Distributed under the terms of the MIT license, see ../LICENSE.code
+ */
+
+#include "pz_common.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <memory>
+
+#include "pz.h"
+#include "pz_closure.h"
+#include "pz_code.h"
+#include "pz_image.h"
+#include "pz_io.h"
+#include "pz_module.h"
+#include "pz_read.h"
+#include "pz_util.h"
+
+namespace pz {
+
+/*
+ * Image format
+ *
+ * Like the PZ format numbers are big-endian, but unlike it the contents
+ * of data items and procedures are stored exactly as they are in memory.
+ *
+ *   Image ::= Magic(32bit) Version(16bit) BuildID(64bit) SourceHash(64bit)
+ *             EntryClosure(32bit) NumImports(32bit) NumDatas(32bit)
+ *             NumProcs(32bit) NumClosures(32bit) NumExports(32bit)
+ *             Import* Item(Data)* Item(Proc)* Closure* Export*
+ *
+ *   Import ::= ModuleName(LenString) SymbolName(LenString)
+ *
+ *   Item ::= Size(32bit) Bytes NumRelocs(32bit) Reloc*
+ *
+ *   Reloc ::= Kind(8bit) Offset(32bit) Target(32bit) Addend(32bit)
+ *
+ *   Closure ::= ProcID(32bit) DataID(32bit)
+ *
+ *   Export ::= SymbolName(LenString) ClosureID(32bit)
+ *
+ * The word at each relocation's offset is stored as zero.
+ */
+static const uint32_t Image_Magic = 0x505A494D; // "PZIM"
+static const uint16_t Image_Version = 2;
+
+/*
+ * Image keys
+ *************/
+
+static uint64_t
+hash_bytes(const uint8_t *bytes, size_t len, uint64_t hash)
+{
+    const uint64_t prime = 0x100000001b3;
+    size_t         i = 0;
+
+    // FNV-1a a word at a time with an extra shift to mix high bits down.
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, &bytes[i], sizeof(word));
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 29;
+    }
+    for (; i < len; i++) {
+        hash = (hash ^ bytes[i]) * prime;
+    }
+
+    return hash;
+}
+
+static const uint64_t Hash_Seed = 0xcbf29ce484222325;
+
+/*
+ * Identify the runtime build by its executable's size and modification
+ * time.
+ */
+static Optional<uint64_t>
+runtime_build_id()
+{
+    struct stat st;
+    if (stat("/proc/self/exe", &st) != 0) {
+        return Optional<uint64_t>::Nothing();
+    }
+
+    uint64_t fields[] = {
+        Image_Version,
+        WORDSIZE_BYTES,
+        uint64_t(st.st_ino),
+        uint64_t(st.st_size),
+        uint64_t(st.st_mtim.tv_sec),
+        uint64_t(st.st_mtim.tv_nsec),
+    };
+    return hash_bytes(reinterpret_cast<const uint8_t*>(fields),
+            sizeof(fields), Hash_Seed);
+}
+
+Optional<ImageKey>
+image_key(const BinaryInput &pz_file)
+{
+    if (!pz_file.mapped_data()) return Optional<ImageKey>::Nothing();
+
+    Optional<uint64_t> build_id = runtime_build_id();
+    if (!build_id.hasValue()) return Optional<ImageKey>::Nothing();
+
+    ImageKey key;
+    key.source_hash = hash_bytes(pz_file.mapped_data(),
+            pz_file.mapped_size(), Hash_Seed);
+    key.build_id = build_id.value();
+    return key;
+}
+
+std::string
+image_filename(const std::string &pz_filename)
+{
+    return pz_filename + "i";
+}
+
+/*
+ * Reading images
+ *****************/
+
+static bool
+read_relocs(BinaryInput &file, uint32_t item_size,
+        std::vector<ImageReloc> &relocs)
+{
+    uint32_t num_relocs;
+    if (!file.read_uint32(&num_relocs)) return false;
+
+    relocs.resize(num_relocs);
+    for (ImageReloc &reloc : relocs) {
+        if (!file.read_uint8(&reloc.kind)) return false;
+        if (!file.read_uint32(&reloc.offset)) return false;
+        if (!file.read_uint32(&reloc.target)) return false;
+        if (!file.read_uint32(&reloc.addend)) return false;
+
+        if (item_size < WORDSIZE_BYTES ||
+                reloc.offset > item_size - WORDSIZE_BYTES)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Apply the relocations to an item.  If the item is data then arena is
+ * its module's data arena, references to closures are registered with it.
+ */
+static bool
+apply_relocs(uint8_t *item, const std::vector<ImageReloc> &relocs,
+        const ModuleLoading &module, const std::vector<Export> &imports,
+        DataArena *arena)
+{
+    for (const ImageReloc &reloc : relocs) {
+        uintptr_t value;
+
+        switch (reloc.kind) {
+            case IRK_DATA:
+                if (reloc.target >= module.num_datas()) return false;
+                value = uintptr_t(module.data(reloc.target));
+                break;
+            case IRK_PROC: {
+                if (reloc.target >= module.num_procs()) return false;
+                const Proc *proc = module.proc(reloc.target);
+                if (reloc.addend >= proc->size()) return false;
+                value = uintptr_t(proc->code() + reloc.addend);
+                break;
+            }
+            case IRK_CLOSURE:
+                if (reloc.target >= module.num_closures()) return false;
+                value = uintptr_t(module.closure(reloc.target));
+                break;
+            case IRK_IMPORT:
+                if (reloc.target >= imports.size()) return false;
+                value = uintptr_t(imports[reloc.target].closure());
+                break;
+            case IRK_IMPORT_CCALL:
+                // C functions move between runs of the same build.
+                if (reloc.target >= imports.size()) return false;
+                if (!imports[reloc.target].ccall().hasValue()) return false;
+                value = imports[reloc.target].ccall().value().func;
+                break;
+            default:
+                return false;
+        }
+
+        memcpy(&item[reloc.offset], &value, sizeof(value));
+        if (arena && (reloc.kind == IRK_CLOSURE || reloc.kind == IRK_IMPORT))
+        {
+            arena->add_heap_ref(reinterpret_cast<void**>(
+                        &item[reloc.offset]));
+        }
+    }
+
+    return true;
+}
+
+static bool
+read_image_items(PZ &pz, BinaryInput &file,
+        std::unique_ptr<ModuleLoading> &module, int32_t *entry_closure,
+        bool verbose)
+{
+    uint32_t entry_closure_uint;
+    uint32_t num_imports, num_datas, num_procs, num_closures, num_exports;
+
+    if (!file.read_uint32(&entry_closure_uint)) return false;
+    if (!file.read_uint32(&num_imports)) return false;
+    if (!file.read_uint32(&num_datas)) return false;
+    if (!file.read_uint32(&num_procs)) return false;
+    if (!file.read_uint32(&num_closures)) return false;
+    if (!file.read_uint32(&num_exports)) return false;
+
+    /*
+     * As when reading a PZ file, the imported modules are read before
+     * this module allocates anything.
+     */
+    std::vector<Export> imports;
+    imports.reserve(num_imports);
+    for (unsigned i = 0; i < num_imports; i++) {
+        Optional<std::string> module_name = file.read_len_string();
+        if (!module_name.hasValue()) return false;
+        Optional<StringView> name = file.read_len_string_view();
+        if (!name.hasValue()) return false;
+
+        Module *import_module = load_module(pz, module_name.value(),
+                file.filename(), verbose);
+        if (!import_module) return false;
+        Optional<Export> export_ = import_module->lookup_symbol(
+                pz.symbols().intern(name.value().str()));
+        if (!export_.hasValue()) return false;
+        imports.push_back(export_.value());
+    }
+
+    {
+        NoRootsTracer no_roots(pz.heap());
+        NoGCScope no_gc(&no_roots);
+
+        module.reset(new ModuleLoading(0, num_datas, num_procs,
+                    num_closures, no_gc));
+
+        no_gc.abort_if_oom("loading a module");
+    }
+
+    /*
+     * Allocate and fill in every item first.  The relocated words are
+     * zero until they're applied below, which is safe if we GC in the
+     * meantime.  Data is allocated outside the heap.
+     */
+    std::vector<std::vector<ImageReloc>> data_relocs(num_datas);
+    for (unsigned i = 0; i < num_datas; i++) {
+        uint32_t size;
+        if (!file.read_uint32(&size)) return false;
+
+        void *data = module->data_arena().alloc(size);
+        if (!data) return false;
+        if (!file.read_data(data, size)) return false;
+        module->add_data(data);
+
+        if (!read_relocs(file, size, data_relocs[i])) return false;
+    }
+
+    std::vector<std::vector<ImageReloc>> proc_relocs(num_procs);
+    for (unsigned i = 0; i < num_procs; i++) {
+        uint32_t size;
+        if (!file.read_uint32(&size)) return false;
+        if (size == 0) return false;
+
+        Proc *proc = module->new_proc(size, *module);
+        if (!proc) return false;
+        if (!file.read_data(proc->code(), size)) return false;
+
+        if (!read_relocs(file, size, proc_relocs[i])) return false;
+    }
+
+    for (unsigned i = 0; i < num_closures; i++) {
+        uint32_t proc_id, data_id;
+        if (!file.read_uint32(&proc_id)) return false;
+        if (!file.read_uint32(&data_id)) return false;
+        if (proc_id >= num_procs || data_id >= num_datas) return false;
+
+        module->closure(i)->init(module->proc(proc_id)->code(),
+                module->data(data_id));
+    }
+
+    for (unsigned i = 0; i < num_exports; i++) {
+        Optional<StringView> name = file.read_len_string_view();
+        if (!name.hasValue()) return false;
+        uint32_t closure_id;
+        if (!file.read_uint32(&closure_id)) return false;
+        if (closure_id >= num_closures) return false;
+
+        module->add_symbol(pz.symbols().intern(name.value().str()),
+                module->closure(closure_id));
+    }
+
+    for (unsigned i = 0; i < num_datas; i++) {
+        if (!apply_relocs(static_cast<uint8_t*>(module->data(i)),
+                    data_relocs[i], *module, imports,
+                    &module->data_arena()))
+        {
+            return false;
+        }
+    }
+    for (unsigned i = 0; i < num_procs; i++) {
+        if (!apply_relocs(module->proc(i)->code(), proc_relocs[i],
+                    *module, imports, nullptr))
+        {
+            return false;
+        }
+    }
+
+    uint8_t extra_byte;
+    if (file.read_uint8(&extra_byte)) return false;
+
+    *entry_closure = (int32_t)entry_closure_uint;
+    return true;
+}
+
+ModuleLoading *
+read_image(PZ &pz, const std::string &filename, const ImageKey &key,
+        int32_t *entry_closure, bool verbose)
+{
+    BinaryInput file;
+    uint32_t    magic;
+    uint16_t    version;
+    uint64_t    build_id, source_hash;
+
+    if (!file.open(filename)) {
+        // There's no image yet.
+        return nullptr;
+    }
+
+    if (!file.read_uint32(&magic) || magic != Image_Magic ||
+            !file.read_uint16(&version) || version != Image_Version ||
+            !file.read_uint64(&build_id) || build_id != key.build_id ||
+            !file.read_uint64(&source_hash) ||
+            source_hash != key.source_hash)
+    {
+        if (verbose) {
+            printf("Image %s is out of date\n", filename.c_str());
+        }
+        file.close();
+        return nullptr;
+    }
+
+    std::unique_ptr<ModuleLoading> module;
+    if (!read_image_items(pz, file, module, entry_closure, verbose)) {
+        fprintf(stderr, "%s: corrupt image, ignoring it.\n",
+                filename.c_str());
+        file.close();
+        return nullptr;
+    }
+    file.close();
+
+    if (verbose) {
+        printf("Loaded image %s\n", filename.c_str());
+        module->print_loaded_stats();
+    }
+
+    return module.release();
+}
+
+/*
+ * Writing images
+ *****************/
+
+static void
+put_uint8(std::vector<uint8_t> &buf, uint8_t value)
+{
+    buf.push_back(value);
+}
+
+static void
+put_uint16(std::vector<uint8_t> &buf, uint16_t value)
+{
+    put_uint8(buf, value >> 8);
+    put_uint8(buf, value);
+}
+
+static void
+put_uint32(std::vector<uint8_t> &buf, uint32_t value)
+{
+    put_uint16(buf, value >> 16);
+    put_uint16(buf, value);
+}
+
+static void
+put_uint64(std::vector<uint8_t> &buf, uint64_t value)
+{
+    put_uint32(buf, value >> 32);
+    put_uint32(buf, value);
+}
+
+static void
+put_len_string(std::vector<uint8_t> &buf, const std::string &str)
+{
+    put_uint16(buf, str.size());
+    buf.insert(buf.end(), str.begin(), str.end());
+}
+
+static void
+put_item(std::vector<uint8_t> &buf, const void *item, uint32_t size,
+        const std::vector<ImageReloc> &relocs)
+{
+    const uint8_t *bytes = static_cast<const uint8_t*>(item);
+
+    put_uint32(buf, size);
+    size_t start = buf.size();
+    buf.insert(buf.end(), bytes, bytes + size);
+
+    put_uint32(buf, relocs.size());
+    for (const ImageReloc &reloc : relocs) {
+        memset(&buf[start + reloc.offset], 0, WORDSIZE_BYTES);
+        put_uint8(buf, reloc.kind);
+        put_uint32(buf, reloc.offset);
+        put_uint32(buf, reloc.target);
+        put_uint32(buf, reloc.addend);
+    }
+}
+
+void
+ImageWriter::add_import(const std::string &module, const std::string &name)
+{
+    m_imports.push_back(make_pair(module, name));
+}
+
+void
+ImageWriter::add_data(const void *data, uint32_t size)
+{
+    m_datas.push_back({data, size, {}});
+}
+
+void
+ImageWriter::add_data_reloc(const void *field, ImageRelocKind kind,
+        uint32_t target)
+{
+    DataInfo &data = m_datas.back();
+    uint32_t offset = static_cast<const uint8_t*>(field) -
+        static_cast<const uint8_t*>(data.data);
+    assert(offset + WORDSIZE_BYTES <= data.size);
+
+    data.relocs.push_back({offset, uint8_t(kind), target, 0});
+}
+
+void
+ImageWriter::add_proc_reloc(unsigned proc_id, unsigned offset,
+        ImageRelocKind kind, uint32_t target, uint32_t addend)
+{
+    if (m_proc_relocs.size() <= proc_id) {
+        m_proc_relocs.resize(proc_id + 1);
+    }
+    m_proc_relocs[proc_id].push_back({offset, uint8_t(kind), target, addend});
+}
+
+void
+ImageWriter::add_closure(uint32_t proc_id, uint32_t data_id)
+{
+    m_closures.push_back(std::make_pair(proc_id, data_id));
+}
+
+void
+ImageWriter::add_export(const std::string &name, uint32_t closure_id)
+{
+    m_exports.push_back(std::make_pair(name, closure_id));
+}
+
+bool
+ImageWriter::write(const std::string &filename, const ModuleLoading &module,
+        int32_t entry_closure) const
+{
+    std::vector<uint8_t> buf;
+
+    put_uint32(buf, Image_Magic);
+    put_uint16(buf, Image_Version);
+    put_uint64(buf, m_key.build_id);
+    put_uint64(buf, m_key.source_hash);
+    put_uint32(buf, uint32_t(entry_closure));
+    put_uint32(buf, m_imports.size());
+    put_uint32(buf, m_datas.size());
+    put_uint32(buf, module.num_procs());
+    put_uint32(buf, m_closures.size());
+    put_uint32(buf, m_exports.size());
+
+    for (auto &import : m_imports) {
+        put_len_string(buf, import.first);
+        put_len_string(buf, import.second);
+    }
+
+    for (const DataInfo &data : m_datas) {
+        put_item(buf, data.data, data.size, data.relocs);
+    }
+
+    const std::vector<ImageReloc> no_relocs;
+    for (unsigned i = 0; i < module.num_procs(); i++) {
+        const Proc *proc = module.proc(i);
+        put_item(buf, proc->code(), proc->size(),
+                i < m_proc_relocs.size() ? m_proc_relocs[i] : no_relocs);
+    }
+
+    for (auto &closure : m_closures) {
+        put_uint32(buf, closure.first);
+        put_uint32(buf, closure.second);
+    }
+
+    for (auto &export_ : m_exports) {
+        put_len_string(buf, export_.first);
+        put_uint32(buf, export_.second);
+    }
+
+    /*
+     * Write to a temporary file and rename it into place so that another
+     * process never sees a partially written image.
+     */
+    std::string temp_filename = filename + ".tmp" + std::to_string(getpid());
+    FILE *file = fopen(temp_filename.c_str(), "wb");
+    if (!file) return false;
+
+    bool ok = fwrite(buf.data(), 1, buf.size(), file) == buf.size();
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || rename(temp_filename.c_str(), filename.c_str()) != 0) {
+        int saved_errno = errno;
+        unlink(temp_filename.c_str());
+        errno = saved_errno;
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace pz
@@ -0,0 +1,124 @@
+/*
+ * Plasma linked module images
+ * vim: ts=4 sw=4 et
+ *
+ * Copyright (C) 2019 Plasma Team
+ * Distributed under the terms of the MIT license, see ../LICENSE.code
+ */
+
+#ifndef PZ_IMAGE_H
+#define PZ_IMAGE_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "pz_cxx_future.h"
+
+namespace pz {
+
+class BinaryInput;
+class ModuleLoading;
+class PZ;
+
+/*
+ * An image is a snapshot of a module after it has been read and linked:
+ * its instruction tokens, data and closures.  Every pointer within them
+ * is stored as a relocation against an item in the image (or an import)
+ * so that loading the image needs only to allocate each item, copy its
+ * contents and apply the relocations, rather than decode the PZ file.
+ *
+ * Token encoding and builtin export IDs differ between runtime builds, so
+ * an image is only used by the build that wrote it, and only for the
+ * exact PZ file it was made from.
+ */
+struct ImageKey {
+    uint64_t    source_hash;
+    uint64_t    build_id;
+};
+
+enum ImageRelocKind {
+    IRK_DATA,           // The address of a data item.
+    IRK_PROC,           // The address of a procedure's code plus the addend.
+    IRK_CLOSURE,        // The address of a closure.
+    IRK_IMPORT,         // The address of an imported closure.
+    IRK_IMPORT_CCALL,   // The C function of an imported C builtin.
+};
+
+struct ImageReloc {
+    uint32_t    offset;
+    uint8_t     kind;
+    uint32_t    target;
+    uint32_t    addend;
+};
+
+/*
+ * Compute the key for a PZ file, this is only possible if the file is
+ * memory mapped.
+ */
+Optional<ImageKey>
+image_key(const BinaryInput &pz_file);
+
+/*
+ * The name of the image for a PZ file.
+ */
+std::string
+image_filename(const std::string &pz_filename);
+
+/*
+ * Load an image if it exists and matches the key.  Returns nullptr if it
+ * doesn't, the caller should then read the PZ file.
+ */
+ModuleLoading *
+read_image(PZ &pz, const std::string &filename, const ImageKey &key,
+        int32_t *entry_closure, bool verbose);
+
+/*
+ * The reader records everything an image needs while it reads a PZ file,
+ * write() then writes the image once the module is linked.
+ */
+class ImageWriter {
+  private:
+    struct DataInfo {
+        const void                 *data;
+        uint32_t                    size;
+        std::vector<ImageReloc>     relocs;
+    };
+
+    ImageKey                                          m_key;
+    std::vector<std::pair<std::string, std::string>>  m_imports;
+    std::vector<DataInfo>                             m_datas;
+    std::vector<std::vector<ImageReloc>>              m_proc_relocs;
+    std::vector<std::pair<uint32_t, uint32_t>>        m_closures;
+    std::vector<std::pair<std::string, uint32_t>>     m_exports;
+
+  public:
+    explicit ImageWriter(const ImageKey &key) : m_key(key) {}
+
+    void add_import(const std::string &module, const std::string &name);
+
+    /*
+     * Add a data item, relocations added by add_data_reloc are made
+     * against the most recently added item.
+     */
+    void add_data(const void *data, uint32_t size);
+    void add_data_reloc(const void *field, ImageRelocKind kind,
+            uint32_t target);
+
+    void add_proc_reloc(unsigned proc_id, unsigned offset,
+            ImageRelocKind kind, uint32_t target, uint32_t addend = 0);
+
+    void add_closure(uint32_t proc_id, uint32_t data_id);
+
+    void add_export(const std::string &name, uint32_t closure_id);
+
+    bool write(const std::string &filename, const ModuleLoading &module,
+            int32_t entry_closure) const;
+
+    ImageWriter(const ImageWriter&) = delete;
+    void operator=(const ImageWriter&) = delete;
+};
+
+} // namespace pz
+
+#endif // ! PZ_IMAGE_H
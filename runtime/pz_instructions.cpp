@@ -108,7 +108,11 @@ InstructionInfo instruction_info[] = {
     /* PZI_CCALL_ALLOC */
     { 0, IMT_PROC_REF },
     /* PZI_CCALL_SPECIAL */
-    { 0, IMT_PROC_REF }
+    { 0, IMT_PROC_REF },
+    /* PZI_LOAD_PROC */
+    { 0, IMT_PROC_REF },
+    /* PZI_CHECK_STACK */
+    { 0, IMT_32 }
 };
 
 } // namespace pz
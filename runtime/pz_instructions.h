@@ -86,7 +86,9 @@ typedef enum {
     PZI_END,
     PZI_CCALL,
     PZI_CCALL_ALLOC,
-    PZI_CCALL_SPECIAL
+    PZI_CCALL_SPECIAL,
+    PZI_LOAD_PROC,
+    PZI_CHECK_STACK
 } PZ_Opcode;
 
 #ifdef __cplusplus
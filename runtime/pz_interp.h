@@ -42,7 +42,13 @@ typedef unsigned (*pz_builtin_c_special_func)(void *stack, unsigned sp,
         PZ &pz);
 
 unsigned
-pz_builtin_print_func(void *stack, unsigned sp);
+pz_builtin_print_func(void *stack, unsigned sp, PZ &pz);
+
+unsigned
+pz_builtin_flush_func(void *stack, unsigned sp, PZ &pz);
+
+unsigned
+pz_builtin_print_int_func(void *stack, unsigned sp, PZ &pz);
 
 unsigned
 pz_builtin_int_to_string_func(void *stack, unsigned sp,
@@ -54,12 +60,91 @@ pz_builtin_setenv_func(void *stack, unsigned sp);
 unsigned
 pz_builtin_gettimeofday_func(void *void_stack, unsigned sp);
 
+unsigned
+pz_builtin_monotonic_ns_func(void *void_stack, unsigned sp);
+
+unsigned
+pz_builtin_cpu_time_ns_func(void *void_stack, unsigned sp);
+
+unsigned
+pz_builtin_thread_cpu_time_ns_func(void *void_stack, unsigned sp);
+
 unsigned
 pz_builtin_concat_string_func(void *stack, unsigned sp,
         AbstractGCTracer &gc_trace);
 
 unsigned
-pz_builtin_die_func(void *stack, unsigned sp);
+pz_builtin_flatten_string_func(void *stack, unsigned sp,
+        AbstractGCTracer &gc_trace);
+
+unsigned
+pz_builtin_array_new_func(void *stack, unsigned sp,
+        AbstractGCTracer &gc_trace);
+
+unsigned
+pz_builtin_array_length_func(void *stack, unsigned sp);
+
+unsigned
+pz_builtin_array_load_func(void *stack, unsigned sp);
+
+unsigned
+pz_builtin_array_store_func(void *stack, unsigned sp);
+
+unsigned
+pz_builtin_array_copy_func(void *stack, unsigned sp);
+
+unsigned
+pz_builtin_array_fill_func(void *stack, unsigned sp);
+
+unsigned
+pz_builtin_map_new_func(void *stack, unsigned sp,
+        AbstractGCTracer &gc_trace);
+
+unsigned
+pz_builtin_map_size_func(void *stack, unsigned sp);
+
+unsigned
+pz_builtin_map_set_func(void *stack, unsigned sp,
+        AbstractGCTracer &gc_trace);
+
+unsigned
+pz_builtin_map_get_func(void *stack, unsigned sp,
+        AbstractGCTracer &gc_trace);
+
+unsigned
+pz_builtin_map_remove_func(void *stack, unsigned sp,
+        AbstractGCTracer &gc_trace);
+
+unsigned
+pz_builtin_map_next_func(void *stack, unsigned sp);
+
+unsigned
+pz_builtin_map_key_func(void *stack, unsigned sp);
+
+unsigned
+pz_builtin_map_value_func(void *stack, unsigned sp);
+
+unsigned
+pz_builtin_string_equals_func(void *stack, unsigned sp,
+        AbstractGCTracer &gc_trace);
+
+unsigned
+pz_builtin_string_compare_func(void *stack, unsigned sp,
+        AbstractGCTracer &gc_trace);
+
+unsigned
+pz_builtin_string_find_func(void *stack, unsigned sp,
+        AbstractGCTracer &gc_trace);
+
+unsigned
+pz_builtin_string_starts_with_func(void *stack, unsigned sp,
+        AbstractGCTracer &gc_trace);
+
+unsigned
+pz_builtin_string_hash_func(void *stack, unsigned sp);
+
+unsigned
+pz_builtin_die_func(void *stack, unsigned sp, PZ &pz);
 
 unsigned
 pz_builtin_set_parameter_func(void *stack, unsigned sp, PZ &pz);
@@ -67,6 +152,15 @@ pz_builtin_set_parameter_func(void *stack, unsigned sp, PZ &pz);
 unsigned
 pz_builtin_get_parameter_func(void *stack, unsigned sp, PZ &pz);
 
+unsigned
+pz_builtin_parameter_id_func(void *stack, unsigned sp);
+
+unsigned
+pz_builtin_set_parameter_by_id_func(void *stack, unsigned sp, PZ &pz);
+
+unsigned
+pz_builtin_get_parameter_by_id_func(void *stack, unsigned sp, PZ &pz);
+
 
 /*
  * The size of "fast" integers in bytes.
@@ -8,6 +8,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "pz_common.h"
 
@@ -17,16 +20,17 @@ namespace pz {
 
 BinaryInput::~BinaryInput()
 {
-    if (m_file) {
+    if (m_file || is_mapped()) {
         assert(!m_filename.empty());
-        if (ferror(m_file)) {
+        if (m_file && ferror(m_file)) {
             perror(m_filename.c_str());
-        } else if (feof(m_file)) {
+        } else if (m_file ? feof(m_file) : m_eof) {
             fprintf(stderr, "%s: Unexpected end of file.\n", m_filename.c_str());
         }
         close();
     }
     assert(!m_file);
+    assert(!is_mapped());
     assert(m_filename.empty());
 }
 
@@ -34,22 +38,68 @@ bool
 BinaryInput::open(const std::string &filename)
 {
     assert(!m_file);
+    assert(!is_mapped());
     assert(m_filename.empty());
     m_file = fopen(filename.c_str(), "rb");
-    if (m_file) {
-        m_filename = std::string(filename);
-        return true;
-    } else {
+    if (!m_file) {
         return false;
     }
+    m_filename = std::string(filename);
+
+    /*
+     * Map the file if we can, if not (eg it's a pipe or it's empty) keep
+     * reading it through m_file.
+     */
+    struct stat st;
+    if (fstat(fileno(m_file), &st) == 0 && S_ISREG(st.st_mode) &&
+            st.st_size > 0)
+    {
+        void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE,
+                fileno(m_file), 0);
+        if (data != MAP_FAILED) {
+            m_data = static_cast<const uint8_t*>(data);
+            m_size = st.st_size;
+            m_pos = 0;
+            m_eof = false;
+            fclose(m_file);
+            m_file = nullptr;
+        }
+    }
+
+    return true;
+}
+
+void
+BinaryInput::open_view(const BinaryInput &mapped)
+{
+    assert(!m_file);
+    assert(!is_mapped());
+    assert(mapped.is_mapped());
+    m_data = mapped.m_data;
+    m_size = mapped.m_size;
+    m_pos = 0;
+    m_eof = false;
+    m_is_view = true;
+    m_filename = mapped.m_filename;
 }
 
 void
 BinaryInput::close()
 {
-    assert(m_file);
-    fclose(m_file);
-    m_file = nullptr;
+    if (is_mapped()) {
+        if (!m_is_view) {
+            munmap(const_cast<uint8_t*>(m_data), m_size);
+        }
+        m_is_view = false;
+        m_data = nullptr;
+        m_size = 0;
+        m_pos = 0;
+    } else {
+        assert(m_file);
+        fclose(m_file);
+        m_file = nullptr;
+    }
+    m_buffer.clear();
     assert(!m_filename.empty());
     m_filename.clear();
 }
@@ -70,18 +120,34 @@ bool
 BinaryInput::seek_set(long pos)
 {
     assert(pos >= 0);
+    if (is_mapped()) {
+        // Like fseek we allow seeking past the end of the file.
+        m_pos = pos;
+        m_eof = false;
+        return true;
+    }
     return fseek(m_file, pos, SEEK_SET) == 0;
 }
 
 bool
 BinaryInput::seek_cur(long pos)
 {
+    if (is_mapped()) {
+        if (pos < 0 && size_t(-pos) > m_pos) return false;
+        m_pos += pos;
+        m_eof = false;
+        return true;
+    }
     return fseek(m_file, pos, SEEK_CUR) == 0;
 }
 
 Optional<unsigned long>
 BinaryInput::tell() const
 {
+    if (is_mapped()) {
+        return Optional<unsigned long>(m_pos);
+    }
+
     long pos = ftell(m_file);
     if (pos < 0) {
         return Optional<unsigned long>::Nothing();
@@ -93,23 +159,38 @@ BinaryInput::tell() const
 bool
 BinaryInput::is_at_eof()
 {
+    if (is_mapped()) {
+        return m_eof;
+    }
     return !!feof(m_file);
 }
 
+const uint8_t *
+BinaryInput::read_bytes_from_file(size_t len)
+{
+    m_buffer.resize(len);
+    if (len != fread(&m_buffer[0], sizeof(uint8_t), len, m_file)) {
+        return nullptr;
+    }
+    return reinterpret_cast<const uint8_t*>(m_buffer.data());
+}
+
 bool
 BinaryInput::read_uint8(uint8_t *value)
 {
-    return (1 == fread(value, sizeof(uint8_t), 1, m_file));
+    const uint8_t *bytes = read_bytes(1);
+    if (!bytes) return false;
+
+    *value = bytes[0];
+
+    return true;
 }
 
 bool
 BinaryInput::read_uint16(uint16_t *value)
 {
-    uint8_t bytes[2];
-
-    if (!fread(bytes, sizeof(uint8_t), 2, m_file)) {
-        return false;
-    }
+    const uint8_t *bytes = read_bytes(2);
+    if (!bytes) return false;
 
     *value = ((uint16_t)bytes[0] << 8) | (uint16_t)bytes[1];
 
@@ -119,11 +200,8 @@ BinaryInput::read_uint16(uint16_t *value)
 bool
 BinaryInput::read_uint32(uint32_t *value)
 {
-    uint8_t bytes[4];
-
-    if (!fread(bytes, sizeof(uint8_t), 4, m_file)) {
-        return false;
-    }
+    const uint8_t *bytes = read_bytes(4);
+    if (!bytes) return false;
 
     *value = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) |
              ((uint32_t)bytes[2] << 8) | (uint32_t)bytes[3];
@@ -134,11 +212,8 @@ BinaryInput::read_uint32(uint32_t *value)
 bool
 BinaryInput::read_uint64(uint64_t *value)
 {
-    uint8_t bytes[8];
-
-    if (!fread(bytes, sizeof(uint8_t), 8, m_file)) {
-        return false;
-    }
+    const uint8_t *bytes = read_bytes(8);
+    if (!bytes) return false;
 
     *value = ((uint64_t)bytes[0] << 56) | ((uint64_t)bytes[1] << 48) |
              ((uint64_t)bytes[2] << 40) | ((uint64_t)bytes[3] << 32) |
@@ -148,6 +223,65 @@ BinaryInput::read_uint64(uint64_t *value)
     return true;
 }
 
+bool
+BinaryInput::read_varint(uint32_t *value)
+{
+    uint32_t result = 0;
+    unsigned shift = 0;
+    uint8_t  byte;
+
+    do {
+        if (!read_uint8(&byte)) return false;
+        // The fifth byte may only hold the top four bits.
+        if (shift == 28 && (byte & 0xF0)) return false;
+        result |= (uint32_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while ((byte & 0x80) && shift < 35);
+
+    if (byte & 0x80) return false;
+    *value = result;
+    return true;
+}
+
+bool
+BinaryInput::read_svarint(int64_t *value)
+{
+    uint64_t result = 0;
+    unsigned shift = 0;
+    uint8_t  byte;
+
+    do {
+        if (!read_uint8(&byte)) return false;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while ((byte & 0x80) && shift < 64);
+
+    if (byte & 0x80) return false;
+    if (shift < 64 && (byte & 0x40)) {
+        // Sign extend.
+        result |= ~(uint64_t)0 << shift;
+    }
+    *value = (int64_t)result;
+    return true;
+}
+
+bool
+BinaryInput::read_data(void *dest, size_t len)
+{
+    const uint8_t *bytes = read_bytes(len);
+    if (!bytes) return false;
+
+    memcpy(dest, bytes, len);
+
+    return true;
+}
+
+bool
+BinaryInput::skip(size_t len)
+{
+    return read_bytes(len) != nullptr;
+}
+
 Optional<std::string>
 BinaryInput::read_len_string()
 {
@@ -162,19 +296,31 @@ BinaryInput::read_len_string()
 Optional<std::string>
 BinaryInput::read_string(uint16_t len)
 {
-    char *buffer;
-
-    buffer = (char*)malloc(sizeof(char) * (len + 1));
-    if (len != fread(buffer, sizeof(char), len, m_file)) {
-        free(buffer);
+    const uint8_t *bytes = read_bytes(len);
+    if (!bytes) {
         return Optional<std::string>::Nothing();
     }
-    buffer[len] = 0;
-    // There's no way to build a C++ string without copying data.
-    std::string string(buffer);
-    free(buffer);
 
-    return Optional<std::string>(string);
+    return Optional<std::string>(
+            std::string(reinterpret_cast<const char*>(bytes), len));
+}
+
+Optional<StringView>
+BinaryInput::read_len_string_view()
+{
+    uint16_t len;
+
+    if (!read_uint16(&len)) {
+        return Optional<StringView>::Nothing();
+    }
+
+    const uint8_t *bytes = read_bytes(len);
+    if (!bytes) {
+        return Optional<StringView>::Nothing();
+    }
+
+    return Optional<StringView>(
+            StringView(reinterpret_cast<const char*>(bytes), len));
 }
 
 }
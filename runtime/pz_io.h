@@ -16,21 +16,42 @@
 namespace pz {
 
 /*
- * A binary input file, this is a wrapper around a FILE pointer.  Internally
- * we use the C API rather than C++ since the C one is simple to use for
- * binary data.
+ * A binary input file.
  *
- * Since it wraps the C FILE structure a failing operation will set errno.
- * Callers should check errno directly.
+ * Regular files are memory mapped and reads advance a position within the
+ * mapping.  Anything that can't be mapped, such as a pipe, is read through
+ * a FILE pointer instead.  Internally we use the C API rather than C++
+ * since the C one is simple to use for binary data.
+ *
+ * When reading through a FILE a failing operation will set errno.  Callers
+ * should check errno directly.
  */
 class BinaryInput {
   private:
-    FILE        *m_file;
-    std::string  m_filename;
+    FILE           *m_file;
+
+    // The mapped file, if it is mapped then m_file is null.
+    const uint8_t  *m_data;
+    size_t          m_size;
+    size_t          m_pos;
+    bool            m_eof;
+    // True if the mapping belongs to another BinaryInput, see open_view().
+    bool            m_is_view;
+
+    // Storage for data read through m_file, see read_bytes().
+    std::string     m_buffer;
+
+    std::string     m_filename;
 
   public:
     BinaryInput() :
         m_file(nullptr),
+        m_data(nullptr),
+        m_size(0),
+        m_pos(0),
+        m_eof(false),
+        m_is_view(false),
+        m_buffer(),
         m_filename() {}
 
     /*
@@ -45,6 +66,12 @@ class BinaryInput {
      */
     bool open(const std::string &filename);
 
+    /*
+     * Open a second, independent, read position within a memory mapped
+     * file.  The view must be closed before the original is.
+     */
+    void open_view(const BinaryInput &mapped);
+
     /*
      * Close the file.
      */
@@ -76,6 +103,27 @@ class BinaryInput {
      */
     bool read_uint64(uint64_t *value);
 
+    /*
+     * Read an unsigned LEB128 integer, it must fit in 32 bits.
+     */
+    bool read_varint(uint32_t *value);
+
+    /*
+     * Read a signed LEB128 integer, it must fit in 64 bits.
+     */
+    bool read_svarint(int64_t *value);
+
+    /*
+     * Read len bytes into dest.
+     */
+    bool read_data(void *dest, size_t len);
+
+    /*
+     * Read and discard len bytes.  Unlike seek_cur this works for files
+     * that aren't mapped, such as pipes.
+     */
+    bool skip(size_t len);
+
     /*
      * Read a length (16 bits) followed by a string of that length.
      */
@@ -86,6 +134,13 @@ class BinaryInput {
      */
     Optional<std::string> read_string(uint16_t len);
 
+    /*
+     * As read_len_string but without copying the string when the file is
+     * memory mapped.  The view is valid until the next read or until
+     * the file is closed, whichever is first.
+     */
+    Optional<StringView> read_len_string_view();
+
     /*
      * seek relative to beginning of file.
      */
@@ -100,8 +155,38 @@ class BinaryInput {
 
     bool is_at_eof();
 
+    /*
+     * The whole file's contents if it is memory mapped, otherwise null.
+     */
+    const uint8_t * mapped_data() const { return m_data; }
+    size_t mapped_size() const { return m_size; }
+
     BinaryInput(const BinaryInput&) = delete;
     void operator=(const BinaryInput&) = delete;
+
+  private:
+    bool is_mapped() const { return m_data != nullptr; }
+
+    /*
+     * Return a pointer to the next len bytes and advance past them, or
+     * nullptr if there are not enough bytes left.  The pointer is valid
+     * until the next read.
+     */
+    const uint8_t * read_bytes(size_t len) {
+        if (is_mapped()) {
+            if (m_pos > m_size || len > m_size - m_pos) {
+                m_eof = true;
+                return nullptr;
+            }
+            const uint8_t *bytes = m_data + m_pos;
+            m_pos += len;
+            return bytes;
+        } else {
+            return read_bytes_from_file(len);
+        }
+    }
+
+    const uint8_t * read_bytes_from_file(size_t len);
 };
 
 } // namespace pz
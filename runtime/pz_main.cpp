@@ -67,7 +67,7 @@ run(pz::Options &options)
     }
 
     Module *builtins = pz.new_module("builtin");
-    pz::setup_builtins(builtins);
+    pz::setup_builtins(builtins, pz.symbols());
     module = read(pz, options.pzfile(), options.verbose());
     if (module != nullptr) {
         int retcode;
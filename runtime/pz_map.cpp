@@ -0,0 +1,316 @@
+/*
+ * Plasma hash maps
+ * vim: ts=4 sw=4 et
+ *
+ * Copyright (C) 2019 Plasma Team
+ * Distributed under the terms of the MIT license, see ../LICENSE.code
+ */
+
+#include <string.h>
+
+#include <new>
+
+#include "pz_common.h"
+
+#include "pz_map.h"
+#include "pz_string.h"
+
+namespace pz {
+
+/*
+ * Control bytes.  Full slots store Ctrl_Full and the top seven bits of the
+ * key's hash.
+ */
+static const uint8_t Ctrl_Empty = 0;
+static const uint8_t Ctrl_Deleted = 1;
+static const uint8_t Ctrl_Full = 0x80;
+
+static const uint32_t Min_Capacity = 8;
+
+static uint8_t
+hash_ctrl(uint64_t hash)
+{
+    return Ctrl_Full | uint8_t(hash >> 57);
+}
+
+/*
+ * Grow when more than 7/8ths of the slots aren't empty.
+ */
+static bool
+too_full(uint32_t used, uint32_t capacity)
+{
+    return uint64_t(used) * 8 > uint64_t(capacity) * 7;
+}
+
+Map *
+Map::alloc(GCCapability &gc_cap, KeyKind key_kind)
+{
+    // Nothing points to the new map until we return, so its first table
+    // must be allocated without a collection.
+    NoGCScope no_gc(&gc_cap);
+
+    void *mem = no_gc.alloc_bytes(sizeof(Map));
+    no_gc.abort_if_oom("allocating a map");
+    Map *map = new(mem) Map(key_kind);
+    map->resize(no_gc, Min_Capacity);
+    no_gc.abort_if_oom("allocating a map");
+    return map;
+}
+
+bool
+Map::lookup(uintptr_t key, uintptr_t *value) const
+{
+    int64_t slot = find(key, hash(key));
+    if (slot < 0) return false;
+
+    *value = entry(m_segments, slot)->value;
+    return true;
+}
+
+bool
+Map::insert(GCCapability &gc_cap, uintptr_t key, uintptr_t value)
+{
+    uint64_t h = hash(key);
+    int64_t slot = find(key, h);
+    if (slot >= 0) {
+        entry(m_segments, slot)->value = value;
+        return true;
+    }
+
+    if (too_full(m_used + 1, m_capacity)) {
+        // If deleted slots are taking up most of the space then rehashing
+        // at the same size is enough to make room.
+        uint32_t capacity = m_capacity;
+        if (too_full(m_count + 1, m_capacity / 2 + m_capacity / 4)) {
+            if (m_capacity >= Max_Capacity) return false;
+            capacity = m_capacity * 2;
+        }
+        if (!resize(gc_cap, capacity)) return false;
+    }
+
+    // The key isn't present so it can go into the first free slot.
+    uint32_t mask = m_capacity - 1;
+    uint32_t i = h & mask;
+    while (*ctrl(m_segments, i) & Ctrl_Full) {
+        i = (i + 1) & mask;
+    }
+
+    uint8_t *c = ctrl(m_segments, i);
+    if (*c == Ctrl_Empty) {
+        m_used++;
+    }
+    *c = hash_ctrl(h);
+    Entry *e = entry(m_segments, i);
+    e->key = key;
+    e->value = value;
+    m_count++;
+    return true;
+}
+
+bool
+Map::remove(uintptr_t key)
+{
+    int64_t slot = find(key, hash(key));
+    if (slot < 0) return false;
+
+    Entry *e = entry(m_segments, slot);
+    e->key = 0;
+    e->value = 0;
+    m_count--;
+
+    // If the next slot is empty then no probe sequence continues through
+    // this one and it can be emptied too.
+    uint32_t next_slot = (slot + 1) & (m_capacity - 1);
+    if (*ctrl(m_segments, next_slot) == Ctrl_Empty) {
+        *ctrl(m_segments, slot) = Ctrl_Empty;
+        m_used--;
+    } else {
+        *ctrl(m_segments, slot) = Ctrl_Deleted;
+    }
+    return true;
+}
+
+int64_t
+Map::next(int64_t pos) const
+{
+    if (pos < 0) pos = 0;
+    for (int64_t i = pos; i < m_capacity; i++) {
+        if (*ctrl(m_segments, i) & Ctrl_Full) return i;
+    }
+    return -1;
+}
+
+bool
+Map::holds_key(uint32_t slot) const
+{
+    return slot < m_capacity && (*ctrl(m_segments, slot) & Ctrl_Full);
+}
+
+uintptr_t
+Map::key_at(uint32_t slot) const
+{
+    assert(slot < m_capacity);
+    return entry(m_segments, slot)->key;
+}
+
+uintptr_t
+Map::value_at(uint32_t slot) const
+{
+    assert(slot < m_capacity);
+    return entry(m_segments, slot)->value;
+}
+
+/*
+ * The MurmurHash3 finaliser, every bit of the input affects every bit of
+ * the output.  Integer keys are often small or sequential so they need it
+ * before we use the low bits for the slot and the high bits for the
+ * control byte.
+ */
+uint64_t
+Map::mix(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= UINT64_C(0xff51afd7ed558ccd);
+    hash ^= hash >> 33;
+    hash *= UINT64_C(0xc4ceb9fe1a85ec53);
+    hash ^= hash >> 33;
+    return hash;
+}
+
+uint64_t
+Map::hash(uintptr_t key) const
+{
+    switch (m_key_kind) {
+        case INT_KEYS:
+            return mix(key);
+        case STRING_KEYS:
+            return mix(reinterpret_cast<String*>(key)->hash());
+    }
+    abort();
+}
+
+bool
+Map::keys_equal(uintptr_t a, uintptr_t b) const
+{
+    if (a == b) return true;
+    if (m_key_kind == INT_KEYS) return false;
+
+    const String *sa = reinterpret_cast<const String*>(a);
+    const String *sb = reinterpret_cast<const String*>(b);
+    // Both hashes are known since we've already hashed the key we're
+    // looking for and the one in the table.
+    return sa->known_hash() == sb->known_hash() &&
+        sa->length() == sb->length() &&
+        memcmp(sa->c_str(), sb->c_str(), sa->length()) == 0;
+}
+
+unsigned
+Map::segment_entries() const
+{
+    return segment_entries(m_capacity);
+}
+
+unsigned
+Map::segment_entries(uint32_t capacity)
+{
+    return capacity < Segment_Entries ? capacity : Segment_Entries;
+}
+
+size_t
+Map::segment_size(uint32_t capacity)
+{
+    return size_t(segment_entries(capacity)) * (sizeof(Entry) + 1);
+}
+
+Map::Entry *
+Map::entry(void **segments, uint32_t slot) const
+{
+    unsigned seg_entries = segment_entries();
+    Entry *entries = reinterpret_cast<Entry*>(segments[slot / seg_entries]);
+    return &entries[slot % seg_entries];
+}
+
+uint8_t *
+Map::ctrl(void **segments, uint32_t slot) const
+{
+    unsigned seg_entries = segment_entries();
+    uint8_t *seg = reinterpret_cast<uint8_t*>(segments[slot / seg_entries]);
+    return seg + seg_entries * sizeof(Entry) + slot % seg_entries;
+}
+
+int64_t
+Map::find(uintptr_t key, uint64_t hash) const
+{
+    uint32_t mask = m_capacity - 1;
+    uint8_t want = hash_ctrl(hash);
+
+    // There's always at least one empty slot so this terminates.
+    for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+        uint8_t c = *ctrl(m_segments, i);
+        if (c == Ctrl_Empty) return -1;
+        if (c == want && keys_equal(entry(m_segments, i)->key, key)) {
+            return i;
+        }
+    }
+}
+
+bool
+Map::resize(GCCapability &gc_cap, uint32_t capacity)
+{
+    assert(capacity >= Min_Capacity && capacity <= Max_Capacity);
+    assert((capacity & (capacity - 1)) == 0);
+
+    // Each new cell is stored in the map as soon as it's allocated, the
+    // map is reachable so a collection during the next allocation won't
+    // free it.
+    unsigned seg_entries = segment_entries(capacity);
+    unsigned num_segments = capacity / seg_entries;
+    m_new_segments = reinterpret_cast<void**>(
+            gc_cap.alloc_bytes(num_segments * sizeof(void*)));
+    if (!m_new_segments) return false;
+    memset(m_new_segments, 0, num_segments * sizeof(void*));
+
+    for (unsigned s = 0; s < num_segments; s++) {
+        void *seg = gc_cap.alloc_bytes(segment_size(capacity));
+        if (!seg) {
+            m_new_segments = nullptr;
+            return false;
+        }
+        memset(seg, 0, segment_size(capacity));
+        m_new_segments[s] = seg;
+    }
+
+    void **old_segments = m_segments;
+    uint32_t old_capacity = m_capacity;
+    unsigned old_seg_entries = segment_entries();
+
+    m_segments = m_new_segments;
+    m_new_segments = nullptr;
+    m_capacity = capacity;
+    m_used = m_count;
+
+    uint32_t mask = capacity - 1;
+    for (uint32_t slot = 0; slot < old_capacity; slot++) {
+        uint8_t *old_seg = reinterpret_cast<uint8_t*>(
+                old_segments[slot / old_seg_entries]);
+        unsigned offset = slot % old_seg_entries;
+        if (!(old_seg[old_seg_entries * sizeof(Entry) + offset] &
+                    Ctrl_Full))
+        {
+            continue;
+        }
+        Entry *old_entry = reinterpret_cast<Entry*>(old_seg) + offset;
+
+        uint64_t h = hash(old_entry->key);
+        uint32_t i = h & mask;
+        while (*ctrl(m_segments, i) != Ctrl_Empty) {
+            i = (i + 1) & mask;
+        }
+        *ctrl(m_segments, i) = hash_ctrl(h);
+        *entry(m_segments, i) = *old_entry;
+    }
+
+    return true;
+}
+
+} // namespace pz
@@ -0,0 +1,134 @@
+/*
+ * Plasma hash maps
+ * vim: ts=4 sw=4 et
+ *
+ * Copyright (C) 2019 Plasma Team
+ * Distributed under the terms of the MIT license, see ../LICENSE.code
+ */
+
+#ifndef PZ_MAP_H
+#define PZ_MAP_H
+
+#include "pz_gc_util.h"
+
+namespace pz {
+
+/*
+ * An open addressing hash map from integers or strings to word-sized
+ * values.
+ *
+ * The table is split into segments so that no part of it is larger than
+ * a GC cell: the map points to a directory of segments, each segment
+ * holds up to Segment_Entries key/value pairs followed by a control byte
+ * for each.  Segments are small enough that several fit in a block.  A
+ * control byte is either empty, deleted, or the top bits of the key's
+ * hash so that most mismatches are rejected without comparing keys.
+ * Probing is linear across the whole table.
+ *
+ * Everything is allocated on the heap and only ever points to the
+ * beginning of cells.  Since the GC scans every word of a cell that's all
+ * it needs to trace maps, their keys and their values.  Keys and values
+ * that aren't pointers may keep some garbage alive, like any other word
+ * that the GC scans conservatively.
+ *
+ * String keys must be flat strings, the map keeps a reference to them.
+ */
+class Map {
+  public:
+    enum KeyKind : uint32_t {
+        INT_KEYS = 0,
+        STRING_KEYS = 1,
+    };
+
+    static constexpr unsigned Segment_Entries = 32;
+    static constexpr unsigned Max_Segments = 256;
+    static constexpr uint32_t Max_Capacity = Segment_Entries * Max_Segments;
+
+  private:
+    struct Entry {
+        uintptr_t   key;
+        uintptr_t   value;
+    };
+
+    KeyKind     m_key_kind;
+    // The number of keys in the map.
+    uint32_t    m_count;
+    // The number of slots that aren't empty, including deleted slots.
+    uint32_t    m_used;
+    // The number of slots, a power of two.
+    uint32_t    m_capacity;
+    void      **m_segments;
+    // The table being built while the map grows, so that the GC can find
+    // it.
+    void      **m_new_segments;
+
+    explicit Map(KeyKind key_kind) :
+        m_key_kind(key_kind), m_count(0), m_used(0), m_capacity(0),
+        m_segments(nullptr), m_new_segments(nullptr) {}
+
+  public:
+    static bool valid_key_kind(uint32_t kind) {
+        return kind == INT_KEYS || kind == STRING_KEYS;
+    }
+
+    /*
+     * Allocate an empty map on the heap, aborts if there's no memory.
+     */
+    static Map * alloc(GCCapability &gc_cap, KeyKind key_kind);
+
+    KeyKind key_kind() const { return m_key_kind; }
+    uint32_t size() const { return m_count; }
+
+    /*
+     * Find a key, returning true and setting value if it's present.
+     */
+    bool lookup(uintptr_t key, uintptr_t *value) const;
+
+    /*
+     * Add a key or replace its value.  Returns false if there's no memory
+     * or the map would have more than Max_Capacity slots.
+     */
+    bool insert(GCCapability &gc_cap, uintptr_t key, uintptr_t value);
+
+    /*
+     * Remove a key, returning false if it wasn't present.
+     */
+    bool remove(uintptr_t key);
+
+    /*
+     * Iterate over the map by slot.  Returns the first slot at or after
+     * pos that holds a key, or -1 if there are none.  The map must not be
+     * changed while it's being iterated.
+     */
+    int64_t next(int64_t pos) const;
+
+    bool holds_key(uint32_t slot) const;
+    uintptr_t key_at(uint32_t slot) const;
+    uintptr_t value_at(uint32_t slot) const;
+
+    Map(const Map &) = delete;
+    void operator=(const Map &) = delete;
+
+  private:
+    static uint64_t mix(uint64_t hash);
+    uint64_t hash(uintptr_t key) const;
+    bool keys_equal(uintptr_t a, uintptr_t b) const;
+
+    unsigned segment_entries() const;
+    static unsigned segment_entries(uint32_t capacity);
+    static size_t segment_size(uint32_t capacity);
+
+    Entry * entry(void **segments, uint32_t slot) const;
+    uint8_t * ctrl(void **segments, uint32_t slot) const;
+
+    /*
+     * Find the slot holding key, or -1.
+     */
+    int64_t find(uintptr_t key, uint64_t hash) const;
+
+    bool resize(GCCapability &gc_cap, uint32_t capacity);
+};
+
+} // namespace pz
+
+#endif /* ! PZ_MAP_H */
@@ -13,12 +13,28 @@
 #include <utility>
 
 #include "pz_closure.h"
+#include "pz_read.h"
 #include "pz_util.h"
 
 #include "pz_module.h"
 
 namespace pz {
 
+/*
+ * SymbolTable class
+ ********************/
+
+SymbolId
+SymbolTable::intern(const std::string &name)
+{
+    auto result = m_ids.insert(std::make_pair(name, SymbolId(m_names.size())));
+    if (result.second) {
+        // Keys within an unordered_map don't move.
+        m_names.push_back(&result.first->first);
+    }
+    return result.first->second;
+}
+
 /*
  * Export class
  ***************/
@@ -27,6 +43,11 @@ Export::Export(pz::Closure *closure, unsigned export_id) :
     m_closure(closure),
     m_export_id(export_id) {}
 
+Export::Export(pz::Closure *closure, unsigned export_id, const CCall &ccall) :
+    m_closure(closure),
+    m_export_id(export_id),
+    m_ccall(ccall) {}
+
 /*
  * ModuleLoading class
  **********************/
@@ -37,6 +58,7 @@ ModuleLoading::ModuleLoading(unsigned num_structs,
                              unsigned num_closures,
                              NoGCScope &no_gc) :
         AbstractGCTracer(no_gc.heap()),
+        m_data_arena(new DataArena()),
         m_total_code_size(0),
         m_next_export(0)
 {
@@ -83,22 +105,10 @@ ModuleLoading::new_proc(unsigned size, const GCCapability &gc_cap)
 }
 
 void
-ModuleLoading::add_symbol(const std::string &name, Closure *closure)
+ModuleLoading::add_symbol(SymbolId symbol, Closure *closure)
 {
     unsigned id = m_next_export++;
-    m_symbols.insert(make_pair(name, Export(closure, id)));
-}
-
-Optional<unsigned>
-ModuleLoading::lookup_symbol(const std::string &name) const
-{
-    auto iter = m_symbols.find(name);
-
-    if (iter != m_symbols.end()) {
-        return iter->second.id();
-    } else {
-        return Optional<unsigned>::Nothing();
-    }
+    m_symbols.insert(std::make_pair(symbol, Export(closure, id)));
 }
 
 void
@@ -119,8 +129,8 @@ ModuleLoading::do_trace(HeapMarkState *marker) const
         marker->mark_root(s);
     }
 
-    for (void *d : m_datas) {
-        marker->mark_root(d);
+    if (m_data_arena) {
+        m_data_arena->do_trace(marker);
     }
 
     for (void *p : m_procs) {
@@ -148,19 +158,35 @@ Module::Module(Heap *heap) :
 Module::Module(Heap *heap, ModuleLoading &loading, Closure *entry_closure) :
     AbstractGCTracer(heap),
     m_symbols(loading.m_symbols),
-    m_entry_closure(entry_closure) {}
+    m_entry_closure(entry_closure),
+    m_data_arena(std::move(loading.m_data_arena)) {}
+
+Module::~Module() {}
+
+void
+Module::set_lazy_loader(std::unique_ptr<LazyLoader> loader)
+{
+    m_lazy_loader = std::move(loader);
+}
+
+void
+Module::add_symbol(SymbolId symbol, Closure *closure, unsigned export_id)
+{
+    m_symbols.insert(std::make_pair(symbol, Export(closure, export_id)));
+}
 
 void
-Module::add_symbol(const std::string &name, Closure *closure,
-    unsigned export_id)
+Module::add_symbol(SymbolId symbol, Closure *closure, unsigned export_id,
+        const CCall &ccall)
 {
-    m_symbols.insert(make_pair(name, Export(closure, export_id)));
+    m_symbols.insert(std::make_pair(symbol,
+                Export(closure, export_id, ccall)));
 }
 
 Optional<Export>
-Module::lookup_symbol(const std::string& name) const
+Module::lookup_symbol(SymbolId symbol) const
 {
-    auto iter = m_symbols.find(name);
+    auto iter = m_symbols.find(symbol);
 
     if (iter != m_symbols.end()) {
         return iter->second;
@@ -177,6 +203,14 @@ Module::do_trace(HeapMarkState *marker) const
     }
 
     marker->mark_root(m_entry_closure);
+
+    if (m_data_arena) {
+        m_data_arena->do_trace(marker);
+    }
+
+    if (m_lazy_loader) {
+        m_lazy_loader->do_trace(marker);
+    }
 }
 
 } // namespace pz
@@ -11,27 +11,65 @@
 
 #include "pz_common.h"
 
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "pz_closure.h"
 #include "pz_code.h"
 #include "pz_data.h"
 #include "pz_gc_util.h"
+#include "pz_instructions.h"
 
 namespace pz {
 
+typedef uint32_t SymbolId;
+
+/*
+ * Symbol names are interned as they're read, modules then export and look
+ * up symbols by their IDs rather than their names.
+ */
+class SymbolTable {
+  private:
+    std::unordered_map<std::string, SymbolId>   m_ids;
+    std::vector<const std::string*>             m_names;
+
+  public:
+    SymbolTable() {}
+
+    SymbolId intern(const std::string &name);
+
+    const std::string & name(SymbolId id) const { return *m_names.at(id); }
+
+    SymbolTable(const SymbolTable&) = delete;
+    void operator=(const SymbolTable&) = delete;
+};
+
+/*
+ * A builtin that is a single C function.  The loader calls it with a CCALL
+ * instruction at each call site rather than calling its closure.
+ */
+struct CCall {
+    // PZI_CCALL, PZI_CCALL_ALLOC or PZI_CCALL_SPECIAL
+    PZ_Opcode   opcode;
+    uintptr_t   func;
+};
+
 class Export {
   private:
     Closure            *m_closure;
     Optional<unsigned>  m_export_id;
+    Optional<CCall>     m_ccall;
 
   public:
     explicit Export(Closure *closure);
     Export(Closure *closure, unsigned export_id);
+    Export(Closure *closure, unsigned export_id, const CCall &ccall);
 
     Closure* closure() const { return m_closure; }
     unsigned id() const { return m_export_id.value(); }
+    const Optional<CCall> & ccall() const { return m_ccall; }
 };
 
 /*
@@ -44,6 +82,7 @@ class ModuleLoading : public AbstractGCTracer {
   private:
     std::vector<Struct*>     m_structs;
 
+    std::unique_ptr<DataArena>  m_data_arena;
     std::vector<void*>       m_datas;
 
     std::vector<Proc*>       m_procs;
@@ -53,7 +92,7 @@ class ModuleLoading : public AbstractGCTracer {
 
     unsigned                 m_next_export;
 
-    std::unordered_map<std::string, Export> m_symbols;
+    std::unordered_map<SymbolId, Export> m_symbols;
 
     friend class Module;
 
@@ -64,10 +103,16 @@ class ModuleLoading : public AbstractGCTracer {
                   unsigned num_closures,
                   NoGCScope &no_gc);
 
+    unsigned num_structs() const { return m_structs.size(); }
+
     const Struct * struct_(unsigned id) const { return m_structs.at(id); }
 
     Struct * new_struct(unsigned num_fields, const GCCapability &gc_cap);
 
+    DataArena & data_arena() { return *m_data_arena; }
+
+    unsigned num_datas() const { return m_datas.size(); }
+
     void * data(unsigned id) const { return m_datas.at(id); }
 
     void add_data(void *data);
@@ -79,17 +124,14 @@ class ModuleLoading : public AbstractGCTracer {
 
     Proc * new_proc(unsigned size, const GCCapability &gc_cap);
 
+    unsigned num_closures() const { return m_closures.size(); }
+
     Closure * closure(unsigned id) const
     {
         return m_closures.at(id);
     }
 
-    void add_symbol(const std::string &name, Closure *closure);
-
-    /*
-     * Returns the ID of the closure in the exports struct.
-     */
-    Optional<unsigned> lookup_symbol(const std::string& name) const;
+    void add_symbol(SymbolId symbol, Closure *closure);
 
     void print_loaded_stats() const;
 
@@ -99,22 +141,41 @@ class ModuleLoading : public AbstractGCTracer {
     virtual void do_trace(HeapMarkState *marker) const;
 };
 
+class LazyLoader;
+
 class Module : public AbstractGCTracer {
   private:
-    std::unordered_map<std::string, Export>     m_symbols;
+    std::unordered_map<SymbolId, Export>        m_symbols;
     Closure                                    *m_entry_closure;
+    std::unique_ptr<DataArena>                  m_data_arena;
+    std::unique_ptr<LazyLoader>                 m_lazy_loader;
 
   public:
     Module(Heap *heap);
+
+    /*
+     * The module takes ownership of loading's data.
+     */
     Module(Heap *heap, ModuleLoading &loading, Closure *entry_closure);
-    virtual ~Module() { };
+    virtual ~Module();
+
+    /*
+     * Null for modules without any data, such as builtin modules.
+     */
+    DataArena * data_arena() const { return m_data_arena.get(); }
+
+    /*
+     * A module whose procedures are loaded lazily owns its loader.
+     */
+    void set_lazy_loader(std::unique_ptr<LazyLoader> loader);
 
     Closure * entry_closure() const { return m_entry_closure; }
 
-    void add_symbol(const std::string &name, Closure *closure,
-        unsigned export_id);
+    void add_symbol(SymbolId symbol, Closure *closure, unsigned export_id);
+    void add_symbol(SymbolId symbol, Closure *closure, unsigned export_id,
+            const CCall &ccall);
 
-    Optional<Export> lookup_symbol(const std::string& name) const;
+    Optional<Export> lookup_symbol(SymbolId symbol) const;
 
     virtual void do_trace(HeapMarkState *marker) const;
 
@@ -72,6 +72,35 @@ Options::parseEnvironment()
         while (token) {
             if (strcmp(token, "load_verbose") == 0) {
                 m_verbose = true;
+            } else if (strcmp(token, "gc_stats") == 0) {
+                m_gc_stats = true;
+            } else if (strcmp(token, "alloc_profile") == 0) {
+                m_alloc_profile = true;
+            } else if (strncmp(token, "alloc_profile=",
+                        strlen("alloc_profile=")) == 0) {
+                // The sample interval is given in KB.
+                m_alloc_profile = true;
+                m_alloc_profile_interval = 1024 * strtoul(
+                        token + strlen("alloc_profile="), nullptr, 10);
+            } else if (strcmp(token, "image_cache") == 0) {
+                m_image_cache = true;
+            } else if (strcmp(token, "lazy_load") == 0) {
+                m_lazy_load = true;
+            } else if (strncmp(token, "load_threads=",
+                        strlen("load_threads=")) == 0) {
+                m_load_threads = strtoul(token + strlen("load_threads="),
+                        nullptr, 10);
+            } else if (strncmp(token, "load_threads_min_kb=",
+                        strlen("load_threads_min_kb=")) == 0) {
+                m_load_threads_min_size = 1024 * strtoul(
+                        token + strlen("load_threads_min_kb="), nullptr, 10);
+            } else if (strcmp(token, "readonly_data") == 0) {
+                m_readonly_data = true;
+            } else if (strncmp(token, "stdout_buffer=",
+                        strlen("stdout_buffer=")) == 0) {
+                // The size is given in KB.
+                m_stdout_buffer_size = 1024 * strtoul(
+                        token + strlen("stdout_buffer="), nullptr, 10);
             } else {
                 // This warning is non-fatal, so it doesn't set the
                 // error_message_ property or return ERROR.
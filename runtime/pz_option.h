@@ -34,9 +34,22 @@ class Options {
         ERROR,
     };
 
+    static const size_t Default_Alloc_Profile_Interval = 1024;
+    static const size_t Default_Stdout_Buffer_Size = 64 * 1024;
+    static const size_t Default_Load_Threads_Min_Size = 32 * 1024;
+
   private:
     std::string m_pzfile;
     bool        m_verbose;
+    bool        m_gc_stats;
+    bool        m_alloc_profile;
+    size_t      m_alloc_profile_interval;
+    bool        m_image_cache;
+    bool        m_lazy_load;
+    unsigned    m_load_threads;
+    size_t      m_load_threads_min_size;
+    bool        m_readonly_data;
+    size_t      m_stdout_buffer_size;
 
 #ifdef PZ_DEV
     bool        m_interp_trace;
@@ -53,6 +66,15 @@ class Options {
 
   public:
     Options() : m_verbose(false)
+        , m_gc_stats(false)
+        , m_alloc_profile(false)
+        , m_alloc_profile_interval(Default_Alloc_Profile_Interval)
+        , m_image_cache(false)
+        , m_lazy_load(false)
+        , m_load_threads(0)
+        , m_load_threads_min_size(Default_Load_Threads_Min_Size)
+        , m_readonly_data(false)
+        , m_stdout_buffer_size(Default_Stdout_Buffer_Size)
 #ifdef PZ_DEV
         , m_interp_trace(false)
         , m_gc_zealous(false)
@@ -72,6 +94,51 @@ class Options {
 
     bool verbose() const { return m_verbose; }
     std::string pzfile() const { return m_pzfile; }
+    bool gc_stats() const { return m_gc_stats; }
+
+    /*
+     * Allocation profiling and the number of bytes between samples.
+     */
+    bool alloc_profile() const { return m_alloc_profile; }
+    size_t alloc_profile_interval() const {
+        return m_alloc_profile_interval;
+    }
+
+    /*
+     * Cache linked images of programs alongside them and load those
+     * instead when they're up to date.
+     */
+    bool image_cache() const { return m_image_cache; }
+
+    /*
+     * Decode each procedure when it is first called rather than when the
+     * program is loaded.
+     */
+    bool lazy_load() const { return m_lazy_load; }
+
+    /*
+     * The number of threads to decode procedures with, 0 means one per
+     * core.
+     */
+    unsigned load_threads() const { return m_load_threads; }
+
+    /*
+     * The number of bytes of bytecode that each decoding thread should
+     * have at least, smaller modules use fewer threads.
+     */
+    size_t load_threads_min_size() const {
+        return m_load_threads_min_size;
+    }
+
+    /*
+     * Protect modules' constant data from writes once they're loaded.
+     */
+    bool readonly_data() const { return m_readonly_data; }
+
+    /*
+     * The size of the buffer for the program's output, in bytes.
+     */
+    size_t stdout_buffer_size() const { return m_stdout_buffer_size; }
 
 #ifdef PZ_DEV
     bool interp_trace() const { return m_interp_trace; }
@@ -0,0 +1,149 @@
+/*
+ * Plasma buffered output
+ * vim: ts=4 sw=4 et
+ *
+ * Copyright (C) 2019 Plasma Team
+ * Distributed under the terms of the MIT license, see ../LICENSE.code
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "pz_common.h"
+
+#include "pz_output.h"
+#include "pz_string.h"
+
+namespace pz {
+
+OutputBuffer::OutputBuffer(int fd, size_t size) :
+        m_fd(fd),
+        m_buffer(size ? new char[size] : nullptr),
+        m_size(size),
+        m_used(0),
+        m_is_tty(isatty(fd))
+{ }
+
+OutputBuffer::~OutputBuffer()
+{
+    flush();
+}
+
+bool
+OutputBuffer::write(const String *string)
+{
+    bool ok = true;
+
+    string->for_each_piece([this, &ok](const char *bytes, uint32_t len) {
+        if (ok) {
+            ok = write(bytes, len);
+        }
+    });
+
+    if (ok && m_is_tty) {
+        ok = flush();
+    }
+    return ok;
+}
+
+bool
+OutputBuffer::write(const char *bytes, size_t len)
+{
+    if (!len) return true;
+
+    if (len <= m_size - m_used) {
+        memcpy(m_buffer.get() + m_used, bytes, len);
+        m_used += len;
+        return true;
+    }
+
+    if (len < m_size) {
+        // Make room in the buffer.
+        if (!write_through(nullptr, 0)) return false;
+        memcpy(m_buffer.get(), bytes, len);
+        m_used = len;
+        return true;
+    }
+
+    return write_through(bytes, len);
+}
+
+bool
+OutputBuffer::write_int(int64_t num)
+{
+    unsigned length = format_int_length(num);
+    bool     ok;
+
+    if (length <= m_size - m_used) {
+        format_int(num, length, m_buffer.get() + m_used);
+        m_used += length;
+        ok = true;
+    } else {
+        char digits[Max_Int_Chars];
+        format_int(num, length, digits);
+        ok = write(digits, length);
+    }
+
+    if (ok && m_is_tty) {
+        ok = flush();
+    }
+    return ok;
+}
+
+bool
+OutputBuffer::flush()
+{
+    if (!m_used) return true;
+    return write_through(nullptr, 0);
+}
+
+bool
+OutputBuffer::write_through(const char *bytes, size_t len)
+{
+    struct iovec  iov[2];
+    struct iovec *cur = iov;
+    int           count = 0;
+
+    if (m_used) {
+        iov[count].iov_base = m_buffer.get();
+        iov[count].iov_len = m_used;
+        count++;
+    }
+    if (len) {
+        iov[count].iov_base = const_cast<char*>(bytes);
+        iov[count].iov_len = len;
+        count++;
+    }
+    m_used = 0;
+
+    // Anything the runtime printed with stdio must come first.
+    fflush(stdout);
+
+    while (count) {
+        ssize_t written = writev(m_fd, cur, count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            perror("write");
+            return false;
+        }
+
+        // Skip past whatever was written, writes to pipes and sockets may
+        // be short.
+        while (count && size_t(written) >= cur->iov_len) {
+            written -= cur->iov_len;
+            cur++;
+            count--;
+        }
+        if (count) {
+            cur->iov_base = static_cast<char*>(cur->iov_base) + written;
+            cur->iov_len -= written;
+        }
+    }
+
+    return true;
+}
+
+} // namespace pz
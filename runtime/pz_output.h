@@ -0,0 +1,71 @@
+/*
+ * Plasma buffered output
+ * vim: ts=4 sw=4 et
+ *
+ * Copyright (C) 2019 Plasma Team
+ * Distributed under the terms of the MIT license, see ../LICENSE.code
+ */
+
+#ifndef PZ_OUTPUT_H
+#define PZ_OUTPUT_H
+
+#include <memory>
+
+namespace pz {
+
+class String;
+
+/*
+ * A buffer for output written by the print builtin.  It's written to its
+ * file descriptor with write(2), bypassing stdio, when it's full, when
+ * flushed, and when it's destroyed.  Pieces too large to buffer are
+ * gathered with what's already buffered into a single writev(2).
+ *
+ * A size of zero writes every piece straight away.  Output to a terminal
+ * is flushed after each string so that interactive programs don't appear
+ * to stall.
+ */
+class OutputBuffer {
+  private:
+    int                      m_fd;
+    std::unique_ptr<char[]>  m_buffer;
+    size_t                   m_size;
+    size_t                   m_used;
+    bool                     m_is_tty;
+
+  public:
+    OutputBuffer(int fd, size_t size);
+    ~OutputBuffer();
+
+    /*
+     * Write each piece of the string, which may be a rope.  Returns false
+     * if an error occurred writing to the file descriptor.
+     */
+    bool write(const String *string);
+
+    bool write(const char *bytes, size_t len);
+
+    /*
+     * Write num in decimal, formatting it directly into the buffer when
+     * there's room.
+     */
+    bool write_int(int64_t num);
+
+    /*
+     * Write out any buffered bytes.
+     */
+    bool flush();
+
+    OutputBuffer(const OutputBuffer &) = delete;
+    void operator=(const OutputBuffer &) = delete;
+
+  private:
+    /*
+     * Write the buffer followed by len bytes, which may be zero.
+     */
+    bool write_through(const char *bytes, size_t len);
+};
+
+} // namespace pz
+
+#endif /* ! PZ_OUTPUT_H */
@@ -0,0 +1,227 @@
+/*
+ * Plasma runtime parameters
+ * vim: ts=4 sw=4 et
+ *
+ * Copyright (C) 2019 Plasma Team
+ * Distributed under the terms of the MIT license, see ../LICENSE.code
+ */
+
+#include "pz_common.h"
+
+#include <string.h>
+
+#include "pz.h"
+#include "pz_gc.h"
+#include "pz_parameter.h"
+#include "pz_string.h"
+
+namespace pz {
+
+struct Parameter {
+    const char *name;
+    int64_t   (*get)(PZ &pz);
+    // Null for read-only parameters.
+    bool      (*set)(PZ &pz, int64_t value);
+};
+
+static int64_t
+get_heap_size(PZ &pz)
+{
+    return heap_get_size(pz.heap());
+}
+
+static int64_t
+get_heap_max_size(PZ &pz)
+{
+    return heap_get_max_size(pz.heap());
+}
+
+static bool
+set_heap_max_size(PZ &pz, int64_t value)
+{
+    if (value < 0) return false;
+    return heap_set_max_size(pz.heap(), value);
+}
+
+static int64_t
+get_heap_collections(PZ &pz)
+{
+    return heap_get_collections(pz.heap());
+}
+
+static int64_t
+get_gc_total_time_ns(PZ &pz)
+{
+    return heap_get_total_gc_time(pz.heap());
+}
+
+static int64_t
+get_gc_total_time_us(PZ &pz)
+{
+    return get_gc_total_time_ns(pz) / 1000;
+}
+
+static int64_t
+get_gc_max_pause_ns(PZ &pz)
+{
+    return heap_get_max_pause(pz.heap());
+}
+
+static int64_t
+get_gc_max_pause_us(PZ &pz)
+{
+    return get_gc_max_pause_ns(pz) / 1000;
+}
+
+static int64_t
+get_gc_p99_pause_ns(PZ &pz)
+{
+    return heap_get_p99_pause(pz.heap());
+}
+
+static int64_t
+get_gc_p99_pause_us(PZ &pz)
+{
+    return get_gc_p99_pause_ns(pz) / 1000;
+}
+
+/*
+ * Statistics about the last collection are zero until there has been
+ * one.
+ */
+
+static int64_t
+get_gc_last_pause_ns(PZ &pz)
+{
+    const GCCollectionStats *stats = heap_get_last_collection(pz.heap());
+    return stats ? stats->end_time - stats->start_time : 0;
+}
+
+static int64_t
+get_gc_last_mark_ns(PZ &pz)
+{
+    const GCCollectionStats *stats = heap_get_last_collection(pz.heap());
+    return stats ? stats->mark_time : 0;
+}
+
+static int64_t
+get_gc_last_sweep_ns(PZ &pz)
+{
+    const GCCollectionStats *stats = heap_get_last_collection(pz.heap());
+    return stats ? stats->sweep_time : 0;
+}
+
+static int64_t
+get_gc_last_cells_marked(PZ &pz)
+{
+    const GCCollectionStats *stats = heap_get_last_collection(pz.heap());
+    return stats ? stats->cells_marked : 0;
+}
+
+static int64_t
+get_gc_last_bytes_freed(PZ &pz)
+{
+    const GCCollectionStats *stats = heap_get_last_collection(pz.heap());
+    return stats ? stats->bytes_freed : 0;
+}
+
+static int64_t
+get_stdout_buffer_size(PZ &pz)
+{
+    return pz.options().stdout_buffer_size();
+}
+
+static int64_t
+get_load_threads(PZ &pz)
+{
+    return pz.options().load_threads();
+}
+
+/*
+ * A parameter's ID is its index in this table, so new parameters should
+ * be added to the end.
+ */
+static const Parameter s_parameters[] = {
+    { "heap_size",              get_heap_size,          nullptr },
+    { "heap_max_size",          get_heap_max_size,      set_heap_max_size },
+    { "heap_collections",       get_heap_collections,   nullptr },
+    { "gc_total_time_us",       get_gc_total_time_us,   nullptr },
+    { "gc_max_pause_us",        get_gc_max_pause_us,    nullptr },
+    { "gc_p99_pause_us",        get_gc_p99_pause_us,    nullptr },
+    { "gc_total_time_ns",       get_gc_total_time_ns,   nullptr },
+    { "gc_max_pause_ns",        get_gc_max_pause_ns,    nullptr },
+    { "gc_p99_pause_ns",        get_gc_p99_pause_ns,    nullptr },
+    { "gc_last_pause_ns",       get_gc_last_pause_ns,   nullptr },
+    { "gc_last_mark_ns",        get_gc_last_mark_ns,    nullptr },
+    { "gc_last_sweep_ns",       get_gc_last_sweep_ns,   nullptr },
+    { "gc_last_cells_marked",   get_gc_last_cells_marked, nullptr },
+    { "gc_last_bytes_freed",    get_gc_last_bytes_freed, nullptr },
+    { "stdout_buffer_size",     get_stdout_buffer_size, nullptr },
+    { "load_threads",           get_load_threads,       nullptr },
+};
+
+static const unsigned Num_Parameters =
+    sizeof(s_parameters) / sizeof(s_parameters[0]);
+
+namespace {
+
+/*
+ * The names' hashes, so that a lookup only compares the bytes of a name
+ * whose hash matches.
+ */
+struct ParameterHashes {
+    uint32_t    hashes[Num_Parameters];
+
+    ParameterHashes() {
+        for (unsigned i = 0; i < Num_Parameters; i++) {
+            const char *name = s_parameters[i].name;
+            hashes[i] = String::hash_bytes(name, strlen(name));
+        }
+    }
+};
+
+} // anonymous namespace
+
+Optional<ParameterId>
+parameter_lookup(String *name)
+{
+    static const ParameterHashes s_hashes;
+
+    uint32_t hash = name->hash();
+    for (unsigned i = 0; i < Num_Parameters; i++) {
+        if (s_hashes.hashes[i] != hash) continue;
+
+        const char *param = s_parameters[i].name;
+        if (strlen(param) != name->length()) continue;
+        if (name->is_rope()) {
+            if (name->to_std_string() == param) return ParameterId(i);
+        } else if (0 == memcmp(name->c_str(), param, name->length())) {
+            return ParameterId(i);
+        }
+    }
+
+    return Optional<ParameterId>();
+}
+
+bool
+parameter_valid(ParameterId id)
+{
+    return id < Num_Parameters;
+}
+
+int64_t
+parameter_get(PZ &pz, ParameterId id)
+{
+    assert(parameter_valid(id));
+    return s_parameters[id].get(pz);
+}
+
+bool
+parameter_set(PZ &pz, ParameterId id, int64_t value)
+{
+    assert(parameter_valid(id));
+    if (!s_parameters[id].set) return false;
+    return s_parameters[id].set(pz, value);
+}
+
+} // namespace pz
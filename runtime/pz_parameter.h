@@ -0,0 +1,47 @@
+/*
+ * Plasma runtime parameters
+ * vim: ts=4 sw=4 et
+ *
+ * Copyright (C) 2019 Plasma Team
+ * Distributed under the terms of the MIT license, see ../LICENSE.code
+ */
+
+#ifndef PZ_PARAMETER_H
+#define PZ_PARAMETER_H
+
+#include "pz_cxx_future.h"
+
+namespace pz {
+
+class PZ;
+class String;
+
+/*
+ * Runtime parameters are named 64 bit values that a program can read, and
+ * in some cases set, to tune or monitor the runtime.
+ *
+ * Each parameter has a small integer ID.  Looking a name up compares
+ * string hashes and confirms the match once, a program that reads a
+ * parameter often can look up its ID once and use that instead.
+ */
+typedef uint32_t ParameterId;
+
+Optional<ParameterId>
+parameter_lookup(String *name);
+
+bool
+parameter_valid(ParameterId id);
+
+int64_t
+parameter_get(PZ &pz, ParameterId id);
+
+/*
+ * Returns false if the parameter is read-only or the value isn't valid for
+ * it.
+ */
+bool
+parameter_set(PZ &pz, ParameterId id, int64_t value);
+
+} // namespace pz
+
+#endif /* ! PZ_PARAMETER_H */
@@ -9,16 +9,24 @@
 #include <errno.h>
 #include <string.h>
 
+#include <algorithm>
+#include <thread>
+
 #include "pz_common.h"
 
 #include "pz.h"
+#include "pz_array.h"
 #include "pz_closure.h"
 #include "pz_code.h"
 #include "pz_data.h"
 #include "pz_format.h"
+#include "pz_image.h"
 #include "pz_interp.h"
 #include "pz_io.h"
 #include "pz_read.h"
+#include "pz_string.h"
+#include "pz_util.h"
+#include "pz_verify.h"
 
 namespace pz {
 
@@ -27,28 +35,62 @@ struct PZ_Imported {
         num_imports_(num_imports)
     {
         import_closures.reserve(num_imports);
+        import_ccalls.reserve(num_imports);
         imports.reserve(num_imports);
     }
 
     unsigned                    num_imports_;
     std::vector<Closure*>       import_closures;
+    // The C function for imports that are C builtins.
+    std::vector<Optional<CCall>> import_ccalls;
     std::vector<unsigned>       imports;
 };
 
+/*
+ * The file offsets read from a PZ file's directory.
+ */
+struct Directory {
+    uint32_t                sections[PZ_NUM_SECTIONS];
+    std::vector<uint32_t>   data_offsets;
+    std::vector<uint32_t>   proc_offsets;
+};
+
 struct ReadInfo {
-    PZ          &pz;
-    BinaryInput  file;
-    bool         verbose;
+    PZ                            &pz;
+    BinaryInput                   &file;
+    bool                           verbose;
+    // The file's format version.
+    unsigned                       version;
+
+    // Null if the file has no directory.
+    std::unique_ptr<Directory>     directory;
+
+    // Non-null if we're recording an image of the module.
+    std::unique_ptr<ImageWriter>   image;
+
+    // Non-null if procedures are loaded lazily.
+    LazyLoader                    *lazy;
 
-    ReadInfo(PZ &pz, bool verbose) :
-        pz(pz), verbose(verbose) {}
+    ReadInfo(PZ &pz, BinaryInput &file, bool verbose) :
+        pz(pz), file(file), verbose(verbose), version(PZ_FORMAT_VERSION),
+        lazy(nullptr) {}
 
     Heap * heap() const { return pz.heap(); }
 };
 
+static ModuleLoading *
+read_module(ReadInfo &read, int32_t *entry_closure);
+
 static bool
 read_options(BinaryInput &file, int32_t *entry_closure);
 
+static bool
+read_directory(ReadInfo &read, unsigned num_sections, unsigned num_datas,
+        unsigned num_procs);
+
+static bool
+check_section(ReadInfo &read, PZ_Section section);
+
 static bool
 read_imports(ReadInfo    &read,
              unsigned     num_imports,
@@ -74,18 +116,95 @@ read_data_slot(ReadInfo      &read,
                ModuleLoading &module,
                PZ_Imported   &imports);
 
+static bool
+read_data_value(ReadInfo      &read,
+                uint8_t        raw_enc,
+                void          *dest,
+                ModuleLoading &module,
+                PZ_Imported   &imports);
+
+static Optional<uint8_t>
+array_element_enc(PZ_Width width);
+
 static bool
 read_code(ReadInfo      &read,
           unsigned       num_procs,
           ModuleLoading &module,
           PZ_Imported   &imported);
 
+/*
+ * A reference within a procedure's code that can't be resolved until
+ * later.  The word at offset within proc_id's code will be replaced with
+ * the address of the target, a procedure or a block within the same
+ * procedure.
+ */
+struct CodeFixup {
+    unsigned    proc_id;
+    unsigned    offset;
+    uint32_t    target;
+};
+
+/*
+ * No instruction (opcode, alignment padding and immediate value) is longer
+ * than this.
+ */
+constexpr unsigned Max_Instr_Bytes = 2 * sizeof(uint64_t);
+
+static bool
+read_proc(BinaryInput               &file,
+          unsigned                   version,
+          PZ_Imported               &imported,
+          ModuleLoading             &module,
+          unsigned                   num_procs,
+          std::vector<uint8_t>      &code,
+          std::vector<CodeFixup>    &proc_fixups,
+          ImageWriter               *image);
+
 static unsigned
-read_proc(BinaryInput   &file,
-          PZ_Imported   &imported,
-          ModuleLoading &module,
-          uint8_t       *proc_code,
-          unsigned     **block_offsets);
+num_decode_threads(const ReadInfo &read, unsigned num_procs);
+
+static bool
+read_code_parallel(ReadInfo      &read,
+                   unsigned       num_procs,
+                   unsigned       num_threads,
+                   ModuleLoading &module,
+                   PZ_Imported   &imported);
+
+static unsigned
+decode_proc(BinaryInput             &file,
+            unsigned                 version,
+            PZ_Imported             &imported,
+            const ModuleLoading     &module,
+            unsigned                 num_procs,
+            unsigned                 proc_id,
+            std::vector<uint8_t>    &code,
+            std::vector<CodeFixup>  &label_fixups,
+            std::vector<CodeFixup>  &proc_fixups,
+            const LazyLoader        *lazy,
+            ImageWriter             *image);
+
+static bool
+read_raw_proc(BinaryInput &file, unsigned version,
+        std::vector<RawBlock> &blocks);
+
+static bool
+read_instr(BinaryInput &file, unsigned version, RawInstr &instr);
+
+static void
+link_labels(uint8_t *code, const std::vector<CodeFixup> &label_fixups);
+
+static bool
+skip_proc(BinaryInput &file, unsigned version);
+
+static bool
+read_id(BinaryInput &file, unsigned version, uint32_t *value);
+
+static bool
+read_number(BinaryInput &file, unsigned version, unsigned bytes,
+        uint64_t *value);
+
+static std::string
+proc_name(const std::string &filename, unsigned proc_id, bool is_entry);
 
 static bool
 read_closures(ReadInfo      &read,
@@ -93,22 +212,142 @@ read_closures(ReadInfo      &read,
               PZ_Imported   &imported,
               ModuleLoading &module);
 
+static bool
+read_exports(ReadInfo      &read,
+             unsigned       num_exports,
+             ModuleLoading &module);
+
 Module *
 read(PZ &pz, const std::string &filename, bool verbose)
 {
-    ReadInfo     read(pz, verbose);
+    std::unique_ptr<BinaryInput>    file(new BinaryInput());
+    ReadInfo                        read(pz, *file, verbose);
+    int32_t                         entry_closure = -1;
+    std::unique_ptr<ModuleLoading>  module;
+    std::unique_ptr<LazyLoader>     lazy;
+    Optional<ImageKey>              key;
+    std::string                     image_name;
+
+    if (!read.file.open(filename)) {
+        perror(filename.c_str());
+        return nullptr;
+    }
+
+    if (pz.options().image_cache()) {
+        key = image_key(read.file);
+    }
+    if (key.hasValue()) {
+        image_name = image_filename(filename);
+        module.reset(read_image(pz, image_name, key.value(),
+                    &entry_closure, verbose));
+    }
+
+    if (module) {
+        read.file.close();
+    } else {
+        if (key.hasValue()) {
+            read.image.reset(new ImageWriter(key.value()));
+        } else if (pz.options().lazy_load() && read.file.mapped_data()) {
+            // Procedures are decoded from the mapped file when they're
+            // first called.
+            lazy.reset(new LazyLoader(pz));
+            read.lazy = lazy.get();
+        }
+
+        module.reset(read_module(read, &entry_closure));
+        if (!module) return nullptr;
+
+        if (read.image &&
+                !read.image->write(image_name, *module, entry_closure))
+        {
+            fprintf(stderr, "Warning: Couldn't write image %s: %s\n",
+                    image_name.c_str(), strerror(errno));
+        }
+    }
+
+    if (pz.options().readonly_data()) {
+        module->data_arena().make_readonly();
+    }
+
+    AllocProfile *profile = pz.alloc_profile();
+    if (profile && !lazy) {
+        Closure *entry = entry_closure >= 0 ?
+            module->closure(entry_closure) : nullptr;
+        for (unsigned i = 0; i < module->num_procs(); i++) {
+            Proc *proc = module->proc(i);
+            profile->add_proc(
+                    proc_name(filename, i,
+                        entry && entry->code() == proc->code()),
+                    proc->code(), proc->size());
+        }
+    }
+
+    Module *result = new Module(read.heap(), *module,
+            entry_closure >= 0 ? module->closure(entry_closure) : nullptr);
+    if (lazy) {
+        lazy->set_file(std::move(file), read.version);
+        lazy->set_module(std::move(module), result->entry_closure());
+        result->set_lazy_loader(std::move(lazy));
+    }
+    return result;
+}
+
+Module *
+load_module(PZ &pz, const std::string &name, const std::string &importer,
+        bool verbose)
+{
+    Module *module = pz.lookup_module(name);
+    if (module) return module;
+
+    if (!pz.start_loading_module(name)) {
+        fprintf(stderr, "%s: Circular import of module %s\n",
+                importer.c_str(), name.c_str());
+        return nullptr;
+    }
+
+    std::string filename = name + ".pz";
+    std::string::size_type slash = importer.rfind('/');
+    if (slash != std::string::npos) {
+        filename = importer.substr(0, slash + 1) + filename;
+    }
+
+    if (verbose) {
+        printf("Loading module %s from %s\n", name.c_str(),
+                filename.c_str());
+    }
+    module = read(pz, filename, verbose);
+    pz.finish_loading_module(name);
+    if (!module) return nullptr;
+
+    pz.add_module(name, module);
+    return module;
+}
+
+/*
+ * The PZ format doesn't name procedures, so name them by their file and
+ * index.
+ */
+static std::string
+proc_name(const std::string &filename, unsigned proc_id, bool is_entry)
+{
+    std::string name = filename + ":proc_" + std::to_string(proc_id);
+    if (is_entry) {
+        name += "(entry)";
+    }
+    return name;
+}
+
+static ModuleLoading *
+read_module(ReadInfo &read, int32_t *entry_closure)
+{
+    const std::string &filename = read.file.filename();
     uint16_t     magic, version;
-    int32_t      entry_closure = -1;
     uint32_t     num_imports;
     uint32_t     num_structs;
     uint32_t     num_datas;
     uint32_t     num_procs;
     uint32_t     num_closures;
-
-    if (!read.file.open(filename)) {
-        perror(filename.c_str());
-        return nullptr;
-    }
+    uint32_t     num_exports = 0;
 
     if (!read.file.read_uint16(&magic)) return nullptr;
     if (magic != PZ_MAGIC_NUMBER) {
@@ -118,7 +357,7 @@ read(PZ &pz, const std::string &filename, bool verbose)
     }
 
     {
-        Optional<std::string> string = read.file.read_len_string();
+        Optional<StringView> string = read.file.read_len_string_view();
         if (!string.hasValue()) return nullptr;
         if (!startsWith(string.value(), PZ_MAGIC_STRING_PART)) {
             fprintf(stderr, "%s: bad version string, is this a PZ file?\n",
@@ -128,19 +367,42 @@ read(PZ &pz, const std::string &filename, bool verbose)
     }
 
     if (!read.file.read_uint16(&version)) return nullptr;
-    if (version != PZ_FORMAT_VERSION) {
+    if (version > PZ_FORMAT_VERSION) {
         fprintf(stderr, "Incorrect PZ version, found %d, expecting %d\n",
                 version, PZ_FORMAT_VERSION);
         return nullptr;
     }
 
-    if (!read_options(read.file, &entry_closure)) return nullptr;
+    if (!read_options(read.file, entry_closure)) return nullptr;
+
+    read.version = version;
+
+    if (!read_id(read.file, version, &num_imports)) return nullptr;
+    if (!read_id(read.file, version, &num_structs)) return nullptr;
+    if (!read_id(read.file, version, &num_datas)) return nullptr;
+    if (!read_id(read.file, version, &num_procs)) return nullptr;
+    if (!read_id(read.file, version, &num_closures)) return nullptr;
+    if (version > PZ_FORMAT_VERSION_NO_EXPORTS) {
+        if (!read_id(read.file, version, &num_exports)) return nullptr;
+    }
+
+    if (version > PZ_FORMAT_VERSION_NO_DIRECTORY) {
+        unsigned num_sections = version > PZ_FORMAT_VERSION_NO_EXPORTS ?
+            PZ_NUM_SECTIONS : PZ_SECTION_EXPORTS;
+        if (!read_directory(read, num_sections, num_datas, num_procs)) {
+            return nullptr;
+        }
+    }
+
+    /*
+     * Imports are read, which may read the modules they're imported from,
+     * before this module allocates anything.  Those allocations could GC
+     * and nothing would trace this module's items.
+     */
+    std::unique_ptr<PZ_Imported> imported(new PZ_Imported(num_imports));
 
-    if (!read.file.read_uint32(&num_imports)) return nullptr;
-    if (!read.file.read_uint32(&num_structs)) return nullptr;
-    if (!read.file.read_uint32(&num_datas)) return nullptr;
-    if (!read.file.read_uint32(&num_procs)) return nullptr;
-    if (!read.file.read_uint32(&num_closures)) return nullptr;
+    if (!check_section(read, PZ_SECTION_IMPORTS)) return nullptr;
+    if (!read_imports(read, num_imports, *imported)) return nullptr;
 
     std::unique_ptr<ModuleLoading> module;
     {
@@ -154,26 +416,38 @@ read(PZ &pz, const std::string &filename, bool verbose)
         no_gc.abort_if_oom("loading a module");
     }
 
-    PZ_Imported imported(num_imports);
-
-    if (!read_imports(read, num_imports, imported)) return nullptr;
-
+    if (!check_section(read, PZ_SECTION_STRUCTS)) return nullptr;
     if (!read_structs(read, num_structs, *module)) return nullptr;
 
     /*
-     * read the file in two passes.  During the first pass we calculate the
-     * sizes of datas and procedures and therefore calculating the addresses
-     * where each individual entry begins.  Then in the second pass we fill
-     * read the bytecode and data, resolving any intra-module references.
+     * Read the data and then the code.  References from code to
+     * procedures that havn't been read yet are patched once all the code
+     * has been read.
      */
-    if (!read_data(read, num_datas, *module, imported)) {
+    if (!check_section(read, PZ_SECTION_DATAS)) return nullptr;
+    if (!read_data(read, num_datas, *module, *imported)) {
+        return nullptr;
+    }
+    if (!check_section(read, PZ_SECTION_PROCS)) return nullptr;
+    if (!read_code(read, num_procs, *module, *imported)) {
         return nullptr;
     }
-    if (!read_code(read, num_procs, *module, imported)) {
+
+    if (!check_section(read, PZ_SECTION_CLOSURES)) return nullptr;
+    if (!read_closures(read, num_closures, *imported, *module)) {
         return nullptr;
     }
 
-    if (!read_closures(read, num_closures, imported, *module)) {
+    if (num_exports > 0) {
+        if (!check_section(read, PZ_SECTION_EXPORTS)) return nullptr;
+        if (!read_exports(read, num_exports, *module)) return nullptr;
+    }
+
+    if (*entry_closure >= 0 &&
+            unsigned(*entry_closure) >= module->num_closures())
+    {
+        fprintf(stderr, "%s: Entry closure %d doesn't exist\n",
+                filename.c_str(), *entry_closure);
         return nullptr;
     }
 
@@ -192,9 +466,14 @@ read(PZ &pz, const std::string &filename, bool verbose)
         return nullptr;
     }
 #endif
-    read.file.close();
+    if (read.lazy) {
+        // The lazy loader keeps the file open to read procedures from.
+        read.lazy->set_imported(std::move(imported));
+    } else {
+        read.file.close();
+    }
 
-    return new Module(read.heap(), *module, module->closure(entry_closure));
+    return module.release();
 }
 
 static bool
@@ -221,7 +500,7 @@ read_options(BinaryInput &file, int32_t *entry_closure)
                 *entry_closure = (int32_t)entry_closure_uint;
                 break;
             default:
-                if (!file.seek_cur(len)) return false;
+                if (!file.skip(len)) return false;
                 break;
         }
     }
@@ -229,35 +508,124 @@ read_options(BinaryInput &file, int32_t *entry_closure)
     return true;
 }
 
+/*
+ * Read the directory and check that its offsets are in order and within
+ * their sections.
+ */
+static bool
+read_directory(ReadInfo &read, unsigned num_sections, unsigned num_datas,
+        unsigned num_procs)
+{
+    std::unique_ptr<Directory> directory(new Directory());
+
+    for (unsigned i = 0; i < num_sections; i++) {
+        if (!read.file.read_uint32(&directory->sections[i])) return false;
+    }
+    directory->data_offsets.resize(num_datas);
+    for (unsigned i = 0; i < num_datas; i++) {
+        if (!read.file.read_uint32(&directory->data_offsets[i])) {
+            return false;
+        }
+    }
+    directory->proc_offsets.resize(num_procs);
+    for (unsigned i = 0; i < num_procs; i++) {
+        if (!read.file.read_uint32(&directory->proc_offsets[i])) {
+            return false;
+        }
+    }
+
+    // A pipe can't tell us its position.
+    Optional<unsigned long> pos = read.file.tell();
+
+    bool ok = true;
+    uint32_t prev = pos.hasValue() ? pos.value() : 0;
+    for (unsigned i = 0; i < num_sections; i++) {
+        ok = ok && directory->sections[i] >= prev;
+        prev = directory->sections[i];
+    }
+    if (read.file.mapped_data()) {
+        ok = ok && prev <= read.file.mapped_size();
+    }
+
+    uint32_t *sections = directory->sections;
+    auto check_entries = [&](const std::vector<uint32_t> &offsets,
+            PZ_Section section)
+    {
+        uint32_t prev = sections[section];
+        for (uint32_t offset : offsets) {
+            ok = ok && offset >= prev && offset < sections[section + 1];
+            prev = offset;
+        }
+    };
+    check_entries(directory->data_offsets, PZ_SECTION_DATAS);
+    check_entries(directory->proc_offsets, PZ_SECTION_PROCS);
+
+    if (!ok) {
+        fprintf(stderr, "%s: Corrupt directory\n", read.file.filename_c());
+        return false;
+    }
+
+    read.directory = std::move(directory);
+    return true;
+}
+
+/*
+ * Check that we're at the beginning of the section, if the file has a
+ * directory.
+ */
+static bool
+check_section(ReadInfo &read, PZ_Section section)
+{
+    if (!read.directory) return true;
+
+    Optional<unsigned long> pos = read.file.tell();
+    if (pos.hasValue() && pos.value() != read.directory->sections[section])
+    {
+        fprintf(stderr,
+                "%s: Section %d isn't where the directory says it is\n",
+                read.file.filename_c(), section);
+        return false;
+    }
+    return true;
+}
+
 static bool
 read_imports(ReadInfo    &read,
              unsigned     num_imports,
              PZ_Imported &imported)
 {
+    /*
+     * Imports from the same module are usually next to each other, so
+     * remember the last one rather than looking it up each time.
+     */
+    std::string  module;
+    Module      *import_module = nullptr;
+
     for (uint32_t i = 0; i < num_imports; i++) {
-        Optional<std::string> maybe_module = read.file.read_len_string();
+        Optional<StringView> maybe_module = read.file.read_len_string_view();
         if (!maybe_module.hasValue()) return false;
-        std::string module = maybe_module.value();
-        Optional<std::string> maybe_name = read.file.read_len_string();
-        if (!maybe_name.hasValue()) return false;
-        std::string name = maybe_name.value();
 
-        /*
-         * Currently we don't support linking, only the builtin
-         * pseudo-module is recognised.
-         */
-        if ("builtin" != module) {
-            fprintf(stderr, "Linking is not supported.\n");
+        if (!import_module || maybe_module.value() != module.c_str()) {
+            module = maybe_module.value().str();
+            import_module = load_module(read.pz, module,
+                    read.file.filename(), read.verbose);
+            if (!import_module) return false;
         }
 
-        Module *builtin_module = read.pz.lookup_module("builtin");
+        Optional<StringView> maybe_name = read.file.read_len_string_view();
+        if (!maybe_name.hasValue()) return false;
+        std::string name = maybe_name.value().str();
 
         Optional<Export> maybe_export =
-            builtin_module->lookup_symbol(name);
+            import_module->lookup_symbol(read.pz.symbols().intern(name));
         if (maybe_export.hasValue()) {
             Export export_ = maybe_export.value();
             imported.imports.push_back(export_.id());
             imported.import_closures.push_back(export_.closure());
+            imported.import_ccalls.push_back(export_.ccall());
+            if (read.image) {
+                read.image->add_import(module, name);
+            }
         } else {
             fprintf(stderr, "Procedure not found: %s.%s\n",
                     module.c_str(),
@@ -277,7 +645,7 @@ read_structs(ReadInfo      &read,
     for (unsigned i = 0; i < num_structs; i++) {
         uint32_t   num_fields;
 
-        if (!read.file.read_uint32(&num_fields)) return false;
+        if (!read_id(read.file, read.version, &num_fields)) return false;
 
         Struct *s = module.new_struct(num_fields, module);
 
@@ -311,29 +679,71 @@ read_data(ReadInfo      &read,
         if (!read.file.read_uint8(&data_type_id)) return false;
         switch (data_type_id) {
             case PZ_DATA_ARRAY: {
-                uint16_t  num_elements;
+                uint32_t  num_elements;
                 void     *data_ptr;
-                if (!read.file.read_uint16(&num_elements)) return false;
+                if (read.version > PZ_FORMAT_VERSION_FIXED_WIDTH) {
+                    if (!read.file.read_varint(&num_elements)) return false;
+                } else {
+                    uint16_t num_elements16;
+                    if (!read.file.read_uint16(&num_elements16)) {
+                        return false;
+                    }
+                    num_elements = num_elements16;
+                }
                 Optional<PZ_Width> maybe_width = read_data_width(read.file);
                 if (!maybe_width.hasValue()) return false;
                 PZ_Width width = maybe_width.value();
-                data = data_new_array_data(module, width, num_elements);
-                data_ptr = data;
+                // From version 3 the elements of number arrays have no
+                // encoding byte.
+                Optional<uint8_t> element_enc;
+                if (read.version > PZ_FORMAT_VERSION_FIXED_WIDTH) {
+                    element_enc = array_element_enc(width);
+                }
+                Array *array = Array::alloc_constant(module.data_arena(),
+                        width, num_elements);
+                if (!array) return false;
+                data = array;
+                size_t size = Array::alloc_size(array->elem_size(),
+                        num_elements);
+                if (read.image) {
+                    read.image->add_data(data, size);
+                }
+                data_ptr = array->elements();
                 for (unsigned i = 0; i < num_elements; i++) {
-                    if (!read_data_slot(read, data_ptr, module, imports)) {
+                    if (element_enc.hasValue()) {
+                        if (!read_data_value(read, element_enc.value(),
+                                    data_ptr, module, imports))
+                        {
+                            return false;
+                        }
+                    } else if (!read_data_slot(read, data_ptr, module,
+                                imports))
+                    {
                         return false;
                     }
                     data_ptr += width_to_bytes(width);
                 }
-                total_size += width_to_bytes(width) * num_elements;
+                total_size += size;
                 break;
             }
             case PZ_DATA_STRUCT: {
                 uint32_t struct_id;
-                if (!read.file.read_uint32(&struct_id)) return false;
+                if (!read_id(read.file, read.version, &struct_id)) {
+                    return false;
+                }
+                if (struct_id >= module.num_structs()) {
+                    fprintf(stderr, "%s: Data of unknown struct %u\n",
+                            read.file.filename_c(), struct_id);
+                    return false;
+                }
                 const Struct *struct_ = module.struct_(struct_id);
 
-                data = data_new_struct_data(module, struct_->total_size());
+                data = data_new_struct_data(module.data_arena(),
+                        struct_->total_size());
+                if (!data) return false;
+                if (read.image) {
+                    read.image->add_data(data, struct_->total_size());
+                }
                 for (unsigned f = 0; f < struct_->num_fields(); f++) {
                     void *dest = data + struct_->field_offset(f);
                     if (!read_data_slot(read, dest, module, imports)) {
@@ -342,6 +752,33 @@ read_data(ReadInfo      &read,
                 }
                 break;
             }
+            case PZ_DATA_STRING: {
+                uint32_t length;
+                if (!read.file.read_varint(&length)) return false;
+                if (length > String::Max_Length) {
+                    fprintf(stderr, "String constant too long\n");
+                    return false;
+                }
+
+                String *string = String::alloc_constant(module.data_arena(),
+                        length);
+                if (!string) return false;
+                if (!read.file.read_data(string->data(), length)) {
+                    return false;
+                }
+                // The arena may be read-only by the time the hash is
+                // needed.
+                string->hash();
+                data = string;
+                if (read.image) {
+                    read.image->add_data(data, String::alloc_size(length));
+                }
+                total_size += String::alloc_size(length);
+                break;
+            }
+            default:
+                fprintf(stderr, "Unknown data type: %d\n", data_type_id);
+                return false;
         }
 
         module.add_data(data);
@@ -370,65 +807,74 @@ read_data_slot(ReadInfo      &read,
                ModuleLoading &module,
                PZ_Imported   &imports)
 {
-    uint8_t               enc_width, raw_enc;
-    enum pz_data_enc_type type;
+    uint8_t raw_enc;
 
     if (!read.file.read_uint8(&raw_enc)) return false;
-    type = PZ_DATA_ENC_TYPE(raw_enc);
+    return read_data_value(read, raw_enc, dest, module, imports);
+}
+
+static bool
+read_data_value(ReadInfo      &read,
+                uint8_t        raw_enc,
+                void          *dest,
+                ModuleLoading &module,
+                PZ_Imported   &imports)
+{
+    enum pz_data_enc_type type = PZ_DATA_ENC_TYPE(raw_enc);
+    uint64_t              value;
 
     switch (type) {
-        case pz_data_enc_type_normal:
-            enc_width = PZ_DATA_ENC_BYTES(raw_enc);
+        case pz_data_enc_type_normal: {
+            unsigned enc_width = PZ_DATA_ENC_BYTES(raw_enc);
             switch (enc_width) {
-                case 1: {
-                    uint8_t value;
-                    if (!read.file.read_uint8(&value)) return false;
+                case 1:
+                    if (!read_number(read.file, read.version, 1, &value)) {
+                        return false;
+                    }
                     data_write_normal_uint8(dest, value);
                     return true;
-                }
-                case 2: {
-                    uint16_t value;
-                    if (!read.file.read_uint16(&value)) return false;
+                case 2:
+                    if (!read_number(read.file, read.version, 2, &value)) {
+                        return false;
+                    }
                     data_write_normal_uint16(dest, value);
                     return true;
-                }
-                case 4: {
-                    uint32_t value;
-                    if (!read.file.read_uint32(&value)) return false;
+                case 4:
+                    if (!read_number(read.file, read.version, 4, &value)) {
+                        return false;
+                    }
                     data_write_normal_uint32(dest, value);
                     return true;
-                }
-                case 8: {
-                    uint64_t value;
-                    if (!read.file.read_uint64(&value)) return false;
+                case 8:
+                    if (!read_number(read.file, read.version, 8, &value)) {
+                        return false;
+                    }
                     data_write_normal_uint64(dest, value);
                     return true;
-                }
                 default:
                     fprintf(stderr, "Unexpected data encoding %d.\n",
                             raw_enc);
                     return false;
             }
-        case pz_data_enc_type_fast: {
-            uint32_t i32;
-
+        }
+        case pz_data_enc_type_fast:
             /*
              * For these width types the encoded width is 32bit.
              */
-            if (!read.file.read_uint32(&i32)) return false;
-            data_write_fast_from_int32(dest, i32);
+            if (!read_number(read.file, read.version, 4, &value)) {
+                return false;
+            }
+            data_write_fast_from_int32(dest, uint32_t(value));
             return true;
-        }
-        case pz_data_enc_type_wptr: {
-            int32_t i32;
-
+        case pz_data_enc_type_wptr:
             /*
              * For these width types the encoded width is 32bit.
              */
-            if (!read.file.read_uint32((uint32_t *)&i32)) return false;
-            data_write_wptr(dest, (uintptr_t)i32);
+            if (!read_number(read.file, read.version, 4, &value)) {
+                return false;
+            }
+            data_write_wptr(dest, (uintptr_t)(int32_t)value);
             return true;
-        }
         case pz_data_enc_type_data: {
             uint32_t ref;
             void **  dest_ = (void **)dest;
@@ -437,13 +883,18 @@ read_data_slot(ReadInfo      &read,
             // Data is a reference, link in the correct information.
             // XXX: support non-data references, such as proc
             // references.
-            if (!read.file.read_uint32(&ref)) return false;
+            if (!read_id(read.file, read.version, &ref)) return false;
+            // Only data that has already been read may be referred to,
+            // forward references arn't yet supported.
+            if (ref >= module.num_datas()) {
+                fprintf(stderr, "%s: Reference to unknown or later data %u\n",
+                        read.file.filename_c(), ref);
+                return false;
+            }
             data = module.data(ref);
-            if (data != nullptr) {
-                *dest_ = data;
-            } else {
-                fprintf(stderr, "forward references arn't yet supported.\n");
-                abort();
+            *dest_ = data;
+            if (read.image) {
+                read.image->add_data_reloc(dest, IRK_DATA, ref);
             }
             return true;
         }
@@ -455,21 +906,38 @@ read_data_slot(ReadInfo      &read,
             // Data is a reference, link in the correct information.
             // XXX: support non-data references, such as proc
             // references.
-            if (!read.file.read_uint32(&ref)) return false;
-            assert(ref < imports.num_imports_);
+            if (!read_id(read.file, read.version, &ref)) return false;
+            if (ref >= imports.num_imports_) {
+                fprintf(stderr, "%s: Reference to unknown import %u\n",
+                        read.file.filename_c(), ref);
+                return false;
+            }
             import = imports.import_closures[ref];
             assert(import);
             *dest_ = import;
+            module.data_arena().add_heap_ref(dest_);
+            if (read.image) {
+                read.image->add_data_reloc(dest, IRK_IMPORT, ref);
+            }
             return true;
         }
         case pz_data_enc_type_closure: {
             uint32_t   ref;
             void     **dest_ = (void **)dest;
 
-            if (!read.file.read_uint32(&ref)) return false;
+            if (!read_id(read.file, read.version, &ref)) return false;
+            if (ref >= module.num_closures()) {
+                fprintf(stderr, "%s: Reference to unknown closure %u\n",
+                        read.file.filename_c(), ref);
+                return false;
+            }
             Closure *closure = module.closure(ref);
             assert(closure);
             *dest_ = closure;
+            module.data_arena().add_heap_ref(dest_);
+            if (read.image) {
+                read.image->add_data_reloc(dest, IRK_CLOSURE, ref);
+            }
             return true;
         }
         default:
@@ -479,186 +947,431 @@ read_data_slot(ReadInfo      &read,
     }
 }
 
+/*
+ * The encoding of the elements of an array of width, if they're all
+ * numbers.
+ */
+static Optional<uint8_t>
+array_element_enc(PZ_Width width)
+{
+    switch (width) {
+        case PZW_8:
+            return uint8_t(PZ_MAKE_ENC(pz_data_enc_type_normal, 1));
+        case PZW_16:
+            return uint8_t(PZ_MAKE_ENC(pz_data_enc_type_normal, 2));
+        case PZW_32:
+            return uint8_t(PZ_MAKE_ENC(pz_data_enc_type_normal, 4));
+        case PZW_64:
+            return uint8_t(PZ_MAKE_ENC(pz_data_enc_type_normal, 8));
+        case PZW_FAST:
+            return uint8_t(PZ_MAKE_ENC(pz_data_enc_type_fast, 4));
+        case PZW_PTR:
+            break;
+    }
+    return Optional<uint8_t>::Nothing();
+}
+
 static bool
 read_code(ReadInfo      &read,
           unsigned       num_procs,
           ModuleLoading &module,
           PZ_Imported   &imported)
 {
-    bool             result = false;
-    unsigned       **block_offsets = new unsigned*[num_procs];
-
-    memset(block_offsets, 0, sizeof(unsigned *) * num_procs);
-
-    /*
-     * We read procedures in two phases, once to calculate their sizes, and
-     * label offsets, allocating memory for each one.  Then the we read them
-     * for real in the second phase when memory locations are known.
-     */
-    if (read.verbose) {
-        fprintf(stderr, "Reading procs first pass\n");
-    }
-    auto file_pos = read.file.tell();
-    if (!file_pos.hasValue()) goto end;
-
-    for (unsigned i = 0; i < num_procs; i++) {
-        unsigned  proc_size;
+    if (read.lazy) {
+        /*
+         * Record where each procedure is and give it a stub, it'll be
+         * decoded when the stub is first executed.
+         */
+        read.lazy->reserve_procs(num_procs);
+        if (read.directory) {
+            for (uint32_t offset : read.directory->proc_offsets) {
+                if (!read.lazy->add_stub(module, offset)) return false;
+            }
+            if (!read.file.seek_set(
+                    read.directory->sections[PZ_SECTION_CLOSURES]))
+            {
+                return false;
+            }
+        } else {
+            for (unsigned i = 0; i < num_procs; i++) {
+                Optional<unsigned long> offset = read.file.tell();
+                if (!offset.hasValue()) return false;
+                if (!skip_proc(read.file, read.version)) return false;
+                if (!read.lazy->add_stub(module, offset.value())) {
+                    return false;
+                }
+            }
+        }
 
         if (read.verbose) {
-            fprintf(stderr, "Reading proc %d\n", i);
+            printf("Created stubs for %d procedures.\n", num_procs);
         }
+        return true;
+    }
 
-        proc_size =
-          read_proc(read.file, imported, module, nullptr, &block_offsets[i]);
-        if (proc_size == 0) goto end;
-        module.new_proc(proc_size, module);
+    unsigned num_threads = num_decode_threads(read, num_procs);
+    if (num_threads > 1) {
+        return read_code_parallel(read, num_procs, num_threads, module,
+                imported);
     }
 
     /*
-     * Now that we've allocated memory for all the procedures, re-read them
-     * this time writing them into that memory.  We do this for all the
-     * procedures at once otherwise calls in earlier procedures would not
-     * know the code addresses of later procedures.
+     * Each procedure is read once, into a scratch buffer since we don't
+     * know its size until we've read it.  References to other procedures
+     * may be forward references, so they are recorded and patched once
+     * every procedure has been allocated.
      */
+    std::vector<uint8_t>    code;
+    std::vector<CodeFixup>  proc_fixups;
+
     if (read.verbose) {
-        fprintf(stderr, "Beginning second pass\n");
+        fprintf(stderr, "Reading procs\n");
     }
-    if (!read.file.seek_set(file_pos.value())) goto end;
+
     for (unsigned i = 0; i < num_procs; i++) {
         if (read.verbose) {
             fprintf(stderr, "Reading proc %d\n", i);
         }
 
-        if (0 == read_proc(read.file, imported, module,
-                           module.proc(i)->code(),
-                           &block_offsets[i]))
+        if (!read_proc(read.file, read.version, imported, module,
+                    num_procs, code, proc_fixups, read.image.get()))
         {
-            goto end;
+            return false;
         }
     }
 
-    if (read.verbose) {
-        module.print_loaded_stats();
+    for (const CodeFixup &fixup : proc_fixups) {
+        uint8_t *proc_code = module.proc(fixup.proc_id)->code();
+        *reinterpret_cast<uintptr_t*>(&proc_code[fixup.offset]) =
+            reinterpret_cast<uintptr_t>(module.proc(fixup.target)->code());
     }
-    result = true;
 
-end:
-    if (block_offsets != nullptr) {
-        for (unsigned i = 0; i < num_procs; i++) {
-            if (block_offsets[i] != nullptr) {
-                delete[] block_offsets[i];
-            }
-        }
-        delete[] block_offsets;
+    if (read.verbose) {
+        module.print_loaded_stats();
     }
-    return result;
+    return true;
 }
 
-static unsigned
-read_proc(BinaryInput   &file,
-          PZ_Imported   &imported,
-          ModuleLoading &module,
-          uint8_t       *proc_code,
-          unsigned     **block_offsets)
+static bool
+read_proc(BinaryInput               &file,
+          unsigned                   version,
+          PZ_Imported               &imported,
+          ModuleLoading             &module,
+          unsigned                   num_procs,
+          std::vector<uint8_t>      &code,
+          std::vector<CodeFixup>    &proc_fixups,
+          ImageWriter               *image)
 {
-    uint32_t num_blocks;
-    bool     first_pass = (proc_code == nullptr);
-    unsigned proc_offset = 0;
+    unsigned                proc_id = module.num_procs();
+    std::vector<CodeFixup>  label_fixups;
 
-    /*
-     * XXX: Signatures currently aren't written into the bytecode, but
-     * here's where they might appear.
+    unsigned size = decode_proc(file, version, imported, module, num_procs,
+            proc_id, code, label_fixups, proc_fixups, nullptr, image);
+    if (size == 0) return false;
+
+    Proc *proc = module.new_proc(size, module);
+    if (!proc) return false;
+    memcpy(proc->code(), code.data(), size);
+    link_labels(proc->code(), label_fixups);
+
+    return true;
+}
+
+static unsigned
+num_decode_threads(const ReadInfo &read, unsigned num_procs)
+{
+    /*
+     * Decoding threads need their own read positions within the file, so
+     * it must be mapped.  The image writer isn't thread safe.
      */
+    if (!read.file.mapped_data() || read.image) return 1;
 
-    if (!file.read_uint32(&num_blocks)) return 0;
-    if (first_pass) {
-        /*
-         * This is the first pass - set up the block offsets array.
-         */
-        *block_offsets = new unsigned[num_blocks];
+    unsigned num_threads = read.pz.options().load_threads();
+    if (num_threads == 0) {
+        num_threads = std::thread::hardware_concurrency();
     }
 
-    for (unsigned i = 0; i < num_blocks; i++) {
-        uint32_t num_instructions;
+    /*
+     * Each thread should have a minimum amount of bytecode to decode,
+     * starting a thread costs more than decoding a small amount of code.
+     * The rest of the file is mostly code, that's close enough.
+     */
+    unsigned long code_bytes =
+        read.file.mapped_size() - read.file.tell().value();
+    unsigned long min_bytes = read.pz.options().load_threads_min_size();
+    unsigned long max_threads = num_procs;
+    if (min_bytes > 0) {
+        max_threads = std::min(max_threads, code_bytes / min_bytes);
+    }
+    return std::max<unsigned long>(1, std::min<unsigned long>(num_threads,
+                max_threads));
+}
 
-        if (first_pass) {
-            /*
-             * Fill in the block_offsets array
-             */
-            (*block_offsets)[i] = proc_offset;
+/*
+ * A contiguous range of procedures decoded by one thread.  Their code is
+ * concatenated in code, procs gives where each procedure's code and
+ * label fixups are.  Fixup offsets are relative to their procedure.
+ */
+struct DecodeJob {
+    struct DecodedProc {
+        unsigned    code_offset;
+        unsigned    size;
+        unsigned    label_fixups_end;
+    };
+
+    unsigned                    first_proc;
+    unsigned                    end_proc;
+    unsigned long               file_offset;
+
+    std::vector<uint8_t>        code;
+    std::vector<DecodedProc>    procs;
+    std::vector<CodeFixup>      label_fixups;
+    std::vector<CodeFixup>      proc_fixups;
+    bool                        ok;
+};
+
+static void
+decode_procs(const BinaryInput     &mapped,
+             unsigned               version,
+             PZ_Imported           &imported,
+             const ModuleLoading   &module,
+             unsigned               num_procs,
+             DecodeJob             &job)
+{
+    BinaryInput             file;
+    std::vector<uint8_t>    scratch;
+    std::vector<CodeFixup>  label_fixups;
+
+    file.open_view(mapped);
+    job.ok = file.seek_set(job.file_offset);
+    for (unsigned i = job.first_proc; job.ok && i < job.end_proc; i++) {
+        label_fixups.clear();
+        unsigned size = decode_proc(file, version, imported, module,
+                num_procs, i, scratch, label_fixups, job.proc_fixups,
+                nullptr, nullptr);
+        if (size == 0) {
+            job.ok = false;
+            break;
         }
 
-        if (!file.read_uint32(&num_instructions)) return 0;
-        for (uint32_t j = 0; j < num_instructions; j++) {
-            uint8_t             byte;
-            PZ_Opcode           opcode;
-            Optional<PZ_Width>  width1, width2;
-            ImmediateType       immediate_type;
-            ImmediateValue      immediate_value;
+        unsigned code_offset = job.code.size();
+        job.code.insert(job.code.end(), scratch.begin(),
+                scratch.begin() + size);
+        job.label_fixups.insert(job.label_fixups.end(),
+                label_fixups.begin(), label_fixups.end());
+        job.procs.push_back({code_offset, size,
+                unsigned(job.label_fixups.size())});
+    }
+    file.close();
+}
 
-            /*
-             * Read the opcode and the data width(s)
-             */
-            if (!file.read_uint8(&byte)) return 0;
-            opcode = static_cast<PZ_Opcode>(byte);
-            if (instruction_info[opcode].ii_num_width_bytes > 0) {
-                width1 = read_data_width(file);
-                if (instruction_info[opcode].ii_num_width_bytes
-                        > 1)
-                {
-                    width2 = read_data_width(file);
-                }
+/*
+ * Procedures are independent once every procedure's ID is known, so they
+ * can be decoded in parallel.  The directory says where each procedure
+ * begins, or for files without one a quick pass skips over each procedure
+ * to find out.  The procedures are then divided between threads into
+ * ranges of roughly equal size.  Each thread decodes its range into its
+ * own buffer, without allocating from the heap, and finally this thread
+ * allocates and links each procedure in order.
+ */
+static bool
+read_code_parallel(ReadInfo      &read,
+                   unsigned       num_procs,
+                   unsigned       num_threads,
+                   ModuleLoading &module,
+                   PZ_Imported   &imported)
+{
+    std::vector<unsigned long> offsets;
+
+    offsets.reserve(num_procs + 1);
+    if (read.directory) {
+        offsets.insert(offsets.end(),
+                read.directory->proc_offsets.begin(),
+                read.directory->proc_offsets.end());
+        offsets.push_back(read.directory->sections[PZ_SECTION_CLOSURES]);
+        if (!read.file.seek_set(offsets.back())) return false;
+    } else {
+        for (unsigned i = 0; i < num_procs; i++) {
+            offsets.push_back(read.file.tell().value());
+            if (!skip_proc(read.file, read.version)) return false;
+        }
+        offsets.push_back(read.file.tell().value());
+    }
+
+    if (read.verbose) {
+        fprintf(stderr, "Decoding %u procs with %u threads\n", num_procs,
+                num_threads);
+    }
+
+    std::vector<DecodeJob> jobs(num_threads);
+    unsigned long code_bytes = offsets[num_procs] - offsets[0];
+    unsigned proc = 0;
+    for (unsigned t = 0; t < num_threads; t++) {
+        DecodeJob &job = jobs[t];
+        unsigned long end = offsets[0] + code_bytes * (t + 1) / num_threads;
+
+        job.first_proc = proc;
+        job.file_offset = offsets[proc];
+        while (proc < num_procs &&
+                (offsets[proc] < end || t == num_threads - 1))
+        {
+            proc++;
+        }
+        job.end_proc = proc;
+        job.ok = false;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads - 1);
+    for (unsigned t = 1; t < num_threads; t++) {
+        threads.emplace_back(decode_procs, std::cref(read.file),
+                read.version, std::ref(imported), std::cref(module), num_procs,
+                std::ref(jobs[t]));
+    }
+    decode_procs(read.file, read.version, imported, module, num_procs,
+            jobs[0]);
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    for (DecodeJob &job : jobs) {
+        if (!job.ok) return false;
+
+        unsigned fixup = 0;
+        for (const DecodeJob::DecodedProc &decoded : job.procs) {
+            Proc *proc = module.new_proc(decoded.size, module);
+            if (!proc) return false;
+
+            uint8_t *code = proc->code();
+            memcpy(code, &job.code[decoded.code_offset], decoded.size);
+            for (; fixup < decoded.label_fixups_end; fixup++) {
+                const CodeFixup &label = job.label_fixups[fixup];
+                *reinterpret_cast<uintptr_t*>(&code[label.offset]) =
+                    reinterpret_cast<uintptr_t>(&code[label.target]);
             }
+        }
+    }
 
-            /*
-             * Read any immediate value
-             */
-            immediate_type =
-                instruction_info[opcode].ii_immediate_type;
+    for (const DecodeJob &job : jobs) {
+        for (const CodeFixup &fixup : job.proc_fixups) {
+            uint8_t *proc_code = module.proc(fixup.proc_id)->code();
+            *reinterpret_cast<uintptr_t*>(&proc_code[fixup.offset]) =
+                reinterpret_cast<uintptr_t>(
+                        module.proc(fixup.target)->code());
+        }
+    }
+
+    if (read.verbose) {
+        module.print_loaded_stats();
+    }
+    return true;
+}
+
+/*
+ * Decode a procedure into code, returning its size or zero if there was
+ * an error.
+ *
+ * The procedure is read and verified before any of it is decoded.  The
+ * targets of label_fixups are set to offsets within the procedure,
+ * link_labels() patches them once the code is in place.  References to
+ * other procedures are added to proc_fixups, unless lazy is non-null in
+ * which case they're resolved immediately.
+ */
+static unsigned
+decode_proc(BinaryInput             &file,
+            unsigned                 version,
+            PZ_Imported             &imported,
+            const ModuleLoading     &module,
+            unsigned                 num_procs,
+            unsigned                 proc_id,
+            std::vector<uint8_t>    &code,
+            std::vector<CodeFixup>  &label_fixups,
+            std::vector<CodeFixup>  &proc_fixups,
+            const LazyLoader        *lazy,
+            ImageWriter             *image)
+{
+    std::vector<RawBlock>   blocks;
+    std::vector<StackCheck> checks;
+    unsigned                proc_offset = 0;
+    std::vector<unsigned>   block_offsets;
+
+    if (!read_raw_proc(file, version, blocks)) return 0;
+
+    VerifyInfo info = {module, num_procs, unsigned(imported.imports.size())};
+    if (!verify_proc(file.filename(), proc_id, blocks, info, checks)) {
+        return 0;
+    }
+
+    block_offsets.reserve(blocks.size());
+    auto check = checks.begin();
+
+    for (unsigned i = 0; i < blocks.size(); i++) {
+        const RawBlock &block = blocks[i];
+
+        block_offsets.push_back(proc_offset);
+
+        for (unsigned j = 0; j <= block.size(); j++) {
+            if (code.size() < proc_offset + 2 * Max_Instr_Bytes) {
+                code.resize(std::max(code.size() * 2,
+                            size_t(proc_offset + 2 * Max_Instr_Bytes)));
+            }
+
+            if (check != checks.end() && check->block == i &&
+                    check->instr == j)
+            {
+                ImmediateValue depth;
+                depth.uint32 = check->depth;
+                proc_offset = write_instr(code.data(), proc_offset,
+                        PZI_CHECK_STACK, IMT_32, depth);
+                check++;
+            }
+            if (j == block.size()) break;
+
+            const RawInstr     &instr = block[j];
+            PZ_Opcode           opcode = instr.opcode;
+            unsigned            num_widths;
+            ImmediateType       immediate_type;
+            ImmediateValue      immediate_value;
+            Optional<uint32_t>  fixup_target;
+            // A reference that must be relocated if we write an image.
+            Optional<uint32_t>  reloc_target;
+            ImageRelocKind      reloc_kind = IRK_PROC;
+
+            num_widths = instruction_info[opcode].ii_num_width_bytes;
+            immediate_type = instruction_info[opcode].ii_immediate_type;
+            immediate_value = instr.immediate;
             switch (immediate_type) {
                 case IMT_NONE:
-                    memset(&immediate_value, 0, sizeof(ImmediateValue));
-                    break;
                 case IMT_8:
-                    if (!file.read_uint8(&immediate_value.uint8)) return 0;
-                    break;
                 case IMT_16:
-                    if (!file.read_uint16(&immediate_value.uint16))
-                        return 0;
-                    break;
                 case IMT_32:
-                    if (!file.read_uint32(&immediate_value.uint32))
-                        return 0;
-                    break;
                 case IMT_64:
-                    if (!file.read_uint64(&immediate_value.uint64))
-                        return 0;
                     break;
                 case IMT_CLOSURE_REF: {
-                    uint32_t closure_id;
-                    if (!file.read_uint32(&closure_id)) return 0;
-                    if (!first_pass) {
-                        immediate_value.word =
-                          (uintptr_t)module.closure(closure_id);
-                    } else {
-                        immediate_value.word = 0;
-                    }
+                    uint32_t closure_id = instr.immediate.uint32;
+                    // Closures are allocated before any code is read, so
+                    // this needs no fixup.
+                    immediate_value.word =
+                      (uintptr_t)module.closure(closure_id);
+                    reloc_target = closure_id;
+                    reloc_kind = IRK_CLOSURE;
                     break;
                 }
                 case IMT_PROC_REF: {
-                    uint32_t proc_id;
-                    if (!file.read_uint32(&proc_id)) return 0;
-                    if (!first_pass) {
+                    uint32_t target_id = instr.immediate.uint32;
+                    if (lazy) {
                         immediate_value.word =
-                          (uintptr_t)module.proc(proc_id)->code();
+                            (uintptr_t)lazy->proc_code(target_id);
                     } else {
+                        fixup_target = target_id;
                         immediate_value.word = 0;
                     }
+                    reloc_target = target_id;
+                    reloc_kind = IRK_PROC;
                     break;
                 }
                 case IMT_IMPORT_REF: {
-                    uint32_t import_id;
-                    if (!file.read_uint32(&import_id)) return 0;
+                    uint32_t import_id = instr.immediate.uint32;
                     // TODO Should lookup the offset within the struct in
                     // case there's non-pointer sized things in there.
                     immediate_value.uint16 =
@@ -666,53 +1379,61 @@ read_proc(BinaryInput   &file,
                     break;
                 }
                 case IMT_IMPORT_CLOSURE_REF: {
-                    uint32_t import_id;
-                    if (!file.read_uint32(&import_id)) return 0;
+                    uint32_t import_id = instr.immediate.uint32;
                     immediate_value.word =
                         (uintptr_t)imported.import_closures.at(import_id);
+                    reloc_target = import_id;
+                    reloc_kind = IRK_IMPORT;
                     break;
                 }
-                case IMT_LABEL_REF: {
-                    uint32_t imm32;
-                    if (!file.read_uint32(&imm32)) return 0;
-                    if (!first_pass) {
-                        immediate_value.word =
-                          (uintptr_t)&proc_code[(*block_offsets)[imm32]];
-                    } else {
-                        immediate_value.word = 0;
-                    }
+                case IMT_LABEL_REF:
+                    fixup_target = instr.immediate.uint32;
+                    immediate_value.word = 0;
                     break;
-                }
-                case IMT_STRUCT_REF: {
-                    uint32_t imm32;
-                    if (!file.read_uint32(&imm32)) return 0;
-                    immediate_value.word = module.struct_(imm32)->total_size();
+                case IMT_STRUCT_REF:
+                    immediate_value.word =
+                        module.struct_(instr.immediate.uint32)->total_size();
                     break;
-                }
-                case IMT_STRUCT_REF_FIELD: {
-                    uint32_t   imm32;
-                    uint8_t    imm8;
-
-                    if (!file.read_uint32(&imm32)) return 0;
-                    if (!file.read_uint8(&imm8)) return 0;
+                case IMT_STRUCT_REF_FIELD:
                     immediate_value.uint16 =
-                        module.struct_(imm32)->field_offset(imm8);
+                        module.struct_(instr.immediate.uint32)->
+                            field_offset(instr.field);
                     break;
+            }
+
+            /*
+             * A call to a C builtin becomes a CCALL of its C function,
+             * saving the call into and return from the builtin's
+             * procedure.  Both instructions are the same size and neither
+             * changes the stack depth, so the stack checks still hold.
+             */
+            if (opcode == PZI_CALL_IMPORT) {
+                const Optional<CCall> &ccall =
+                    imported.import_ccalls.at(instr.immediate.uint32);
+                if (ccall.hasValue()) {
+                    opcode = ccall.value().opcode;
+                    assert(instruction_info[opcode].ii_immediate_type ==
+                            IMT_PROC_REF);
+                    immediate_type = IMT_PROC_REF;
+                    immediate_value.word = ccall.value().func;
+                    reloc_kind = IRK_IMPORT_CCALL;
                 }
             }
 
-            if (width1.hasValue()) {
-                if (width2.hasValue()) {
+            uint8_t *proc_code = code.data();
+
+            if (num_widths > 0) {
+                if (num_widths > 1) {
                     assert(immediate_type == IMT_NONE);
                     proc_offset = write_instr(proc_code, proc_offset, opcode,
-                            width1.value(), width2.value());
+                            instr.width1, instr.width2);
                 } else {
                     if (immediate_type == IMT_NONE) {
                         proc_offset = write_instr(proc_code, proc_offset,
-                                opcode, width1.value());
+                                opcode, instr.width1);
                     } else {
                         proc_offset = write_instr(proc_code, proc_offset,
-                                opcode, width1.value(),
+                                opcode, instr.width1,
                                 immediate_type, immediate_value);
                     }
                 }
@@ -724,12 +1445,240 @@ read_proc(BinaryInput   &file,
                             immediate_type, immediate_value);
                 }
             }
+
+            if (fixup_target.hasValue()) {
+                // The reference is always the last word of the
+                // instruction.
+                CodeFixup fixup = {proc_id,
+                    unsigned(proc_offset - WORDSIZE_BYTES),
+                    fixup_target.value()};
+                if (immediate_type == IMT_PROC_REF) {
+                    proc_fixups.push_back(fixup);
+                } else {
+                    label_fixups.push_back(fixup);
+                }
+            }
+
+            if (image && reloc_target.hasValue()) {
+                image->add_proc_reloc(proc_id, proc_offset - WORDSIZE_BYTES,
+                        reloc_kind, reloc_target.value());
+            }
+        }
+    }
+
+    for (CodeFixup &fixup : label_fixups) {
+        fixup.target = block_offsets.at(fixup.target);
+        if (image) {
+            image->add_proc_reloc(proc_id, fixup.offset, IRK_PROC, proc_id,
+                    fixup.target);
         }
     }
 
     return proc_offset;
 }
 
+/*
+ * Read a procedure's instructions without decoding them.
+ */
+static bool
+read_raw_proc(BinaryInput &file, unsigned version,
+        std::vector<RawBlock> &blocks)
+{
+    uint32_t num_blocks;
+
+    /*
+     * XXX: Signatures currently aren't written into the bytecode, but
+     * here's where they might appear.
+     */
+
+    if (!read_id(file, version, &num_blocks)) return false;
+
+    for (unsigned i = 0; i < num_blocks; i++) {
+        uint32_t num_instructions;
+
+        blocks.emplace_back();
+        RawBlock &block = blocks.back();
+
+        if (!read_id(file, version, &num_instructions)) return false;
+        for (uint32_t j = 0; j < num_instructions; j++) {
+            RawInstr instr;
+
+            if (!read_instr(file, version, instr)) return false;
+            block.push_back(instr);
+        }
+    }
+
+    return true;
+}
+
+static bool
+read_instr(BinaryInput &file, unsigned version, RawInstr &instr)
+{
+    uint8_t     byte;
+    uint64_t    number;
+
+    memset(&instr, 0, sizeof(instr));
+
+    /*
+     * Read the opcode and the data width(s)
+     */
+    if (!file.read_uint8(&byte)) return false;
+    if (byte >= PZI_END) {
+        fprintf(stderr, "%s: Unknown opcode %d\n",
+                file.filename().c_str(), byte);
+        return false;
+    }
+    instr.opcode = static_cast<PZ_Opcode>(byte);
+
+    const InstructionInfo &info = instruction_info[instr.opcode];
+    if (info.ii_num_width_bytes > 0) {
+        Optional<PZ_Width> width = read_data_width(file);
+        if (!width.hasValue()) return false;
+        instr.width1 = width.value();
+        if (info.ii_num_width_bytes > 1) {
+            width = read_data_width(file);
+            if (!width.hasValue()) return false;
+            instr.width2 = width.value();
+        }
+    }
+
+    /*
+     * Read any immediate value, references are IDs.
+     */
+    switch (info.ii_immediate_type) {
+        case IMT_NONE:
+            break;
+        case IMT_8:
+            if (!file.read_uint8(&instr.immediate.uint8)) return false;
+            break;
+        case IMT_16:
+            if (!read_number(file, version, 2, &number)) return false;
+            instr.immediate.uint16 = number;
+            break;
+        case IMT_32:
+            if (!read_number(file, version, 4, &number)) return false;
+            instr.immediate.uint32 = number;
+            break;
+        case IMT_64:
+            if (!file.read_uint64(&instr.immediate.uint64)) return false;
+            break;
+        case IMT_STRUCT_REF_FIELD:
+            if (!read_id(file, version, &instr.immediate.uint32)) {
+                return false;
+            }
+            if (!file.read_uint8(&instr.field)) return false;
+            break;
+        case IMT_CLOSURE_REF:
+        case IMT_PROC_REF:
+        case IMT_IMPORT_REF:
+        case IMT_IMPORT_CLOSURE_REF:
+        case IMT_STRUCT_REF:
+        case IMT_LABEL_REF:
+            if (!read_id(file, version, &instr.immediate.uint32)) {
+                return false;
+            }
+            break;
+    }
+
+    return true;
+}
+
+static void
+link_labels(uint8_t *code, const std::vector<CodeFixup> &label_fixups)
+{
+    for (const CodeFixup &fixup : label_fixups) {
+        *reinterpret_cast<uintptr_t*>(&code[fixup.offset]) =
+            reinterpret_cast<uintptr_t>(&code[fixup.target]);
+    }
+}
+
+/*
+ * Skip over a procedure without decoding it.
+ */
+static bool
+skip_proc(BinaryInput &file, unsigned version)
+{
+    uint32_t num_blocks;
+    RawInstr instr;
+
+    if (!read_id(file, version, &num_blocks)) return false;
+    for (unsigned i = 0; i < num_blocks; i++) {
+        uint32_t num_instructions;
+
+        if (!read_id(file, version, &num_instructions)) return false;
+        for (uint32_t j = 0; j < num_instructions; j++) {
+            if (!read_instr(file, version, instr)) return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Read a count or an ID, from version 3 these are Varints.
+ */
+static bool
+read_id(BinaryInput &file, unsigned version, uint32_t *value)
+{
+    if (version > PZ_FORMAT_VERSION_FIXED_WIDTH) {
+        return file.read_varint(value);
+    } else {
+        return file.read_uint32(value);
+    }
+}
+
+/*
+ * Read a number whose value is bytes wide.  From version 3 it's an
+ * SVarint, which must fit in that many bytes as either a signed or an
+ * unsigned number.
+ */
+static bool
+read_number(BinaryInput &file, unsigned version, unsigned bytes,
+        uint64_t *value)
+{
+    if (version > PZ_FORMAT_VERSION_FIXED_WIDTH) {
+        int64_t number;
+
+        if (!file.read_svarint(&number)) return false;
+        if (bytes < 8) {
+            int64_t min = -(int64_t(1) << (bytes*8 - 1));
+            int64_t max = (int64_t(1) << (bytes*8)) - 1;
+            if (number < min || number > max) {
+                fprintf(stderr, "%s: %lld doesn't fit in %u bytes\n",
+                        file.filename_c(), (long long)number, bytes);
+                return false;
+            }
+        }
+        *value = uint64_t(number);
+        return true;
+    }
+
+    switch (bytes) {
+        case 1: {
+            uint8_t number;
+            if (!file.read_uint8(&number)) return false;
+            *value = number;
+            return true;
+        }
+        case 2: {
+            uint16_t number;
+            if (!file.read_uint16(&number)) return false;
+            *value = number;
+            return true;
+        }
+        case 4: {
+            uint32_t number;
+            if (!file.read_uint32(&number)) return false;
+            *value = number;
+            return true;
+        }
+        case 8:
+            return file.read_uint64(value);
+    }
+    fprintf(stderr, "Unexpected number width %u\n", bytes);
+    abort();
+}
+
 static bool
 read_closures(ReadInfo      &read,
               unsigned       num_closures,
@@ -742,17 +1691,203 @@ read_closures(ReadInfo      &read,
         uint8_t    *proc_code;
         void       *data;
 
-        if (!read.file.read_uint32(&proc_id)) return false;
+        if (!read_id(read.file, read.version, &proc_id)) return false;
+        if (proc_id >= module.num_procs()) {
+            fprintf(stderr, "%s: Closure %u of unknown procedure %u\n",
+                    read.file.filename_c(), i, proc_id);
+            return false;
+        }
         proc_code = module.proc(proc_id)->code();
 
-        if (!read.file.read_uint32(&data_id)) return false;
+        if (!read_id(read.file, read.version, &data_id)) return false;
+        if (data_id >= module.num_datas()) {
+            fprintf(stderr, "%s: Closure %u of unknown data %u\n",
+                    read.file.filename_c(), i, data_id);
+            return false;
+        }
         data = module.data(data_id);
 
         module.closure(i)->init(proc_code, data);
+        if (read.image) {
+            read.image->add_closure(proc_id, data_id);
+        }
+        if (read.lazy) {
+            read.lazy->add_closure(proc_id, module.closure(i));
+        }
     }
 
     return true;
 }
 
-} // namespace pz
+static bool
+read_exports(ReadInfo      &read,
+             unsigned       num_exports,
+             ModuleLoading &module)
+{
+    for (unsigned i = 0; i < num_exports; i++) {
+        uint32_t closure_id;
+
+        Optional<StringView> name = read.file.read_len_string_view();
+        if (!name.hasValue()) return false;
+        if (!read_id(read.file, read.version, &closure_id)) return false;
+        if (closure_id >= module.num_closures()) {
+            fprintf(stderr, "%s: Export of unknown closure %u\n",
+                    read.file.filename_c(), closure_id);
+            return false;
+        }
+
+        std::string name_str = name.value().str();
+        module.add_symbol(read.pz.symbols().intern(name_str),
+                module.closure(closure_id));
+        if (read.image) {
+            read.image->add_export(name_str, closure_id);
+        }
+    }
+
+    return true;
+}
+
+/*
+ * LazyLoader class
+ *******************/
+
+LazyLoader::LazyLoader(PZ &pz) :
+    m_pz(pz),
+    m_version(PZ_FORMAT_VERSION),
+    m_entry_closure(nullptr) {}
+
+LazyLoader::~LazyLoader()
+{
+    if (m_file) {
+        m_file->close();
+    }
+}
+
+void
+LazyLoader::reserve_procs(unsigned num_procs)
+{
+    m_procs.reserve(num_procs);
+    m_proc_closures.resize(num_procs);
+}
+
+bool
+LazyLoader::add_stub(ModuleLoading &module, unsigned long offset)
+{
+    // Stubs point into m_procs, so it must never be reallocated.
+    assert(m_procs.size() < m_procs.capacity());
+    m_procs.push_back({this, unsigned(m_procs.size()), offset, nullptr});
+
+    ImmediateValue imm;
+    imm.word = reinterpret_cast<uintptr_t>(&m_procs.back());
+    unsigned size = write_instr(nullptr, 0, PZI_LOAD_PROC, IMT_PROC_REF,
+            imm);
+
+    Proc *stub = module.new_proc(size, module);
+    if (!stub) return false;
+    write_instr(stub->code(), 0, PZI_LOAD_PROC, IMT_PROC_REF, imm);
+
+    return true;
+}
+
+void
+LazyLoader::add_closure(unsigned proc_id, Closure *closure)
+{
+    m_proc_closures.at(proc_id).push_back(closure);
+}
 
+void
+LazyLoader::set_imported(std::unique_ptr<PZ_Imported> imported)
+{
+    m_imported = std::move(imported);
+}
+
+void
+LazyLoader::set_file(std::unique_ptr<BinaryInput> file, unsigned version)
+{
+    assert(file->mapped_data());
+    m_file = std::move(file);
+    m_version = version;
+}
+
+void
+LazyLoader::set_module(std::unique_ptr<ModuleLoading> module,
+        Closure *entry_closure)
+{
+    m_module = std::move(module);
+    m_entry_closure = entry_closure;
+}
+
+uint8_t *
+LazyLoader::proc_code(unsigned proc_id) const
+{
+    const LazyProc &proc = m_procs.at(proc_id);
+    if (proc.code) {
+        return proc.code;
+    } else {
+        return m_module->proc(proc_id)->code();
+    }
+}
+
+uint8_t *
+LazyLoader::load(LazyProc &lazy_proc, GCCapability &gc_cap)
+{
+    std::vector<CodeFixup>  label_fixups;
+    std::vector<CodeFixup>  proc_fixups;
+
+    assert(!lazy_proc.code);
+    if (!m_file->seek_set(lazy_proc.offset)) return nullptr;
+    unsigned size = decode_proc(*m_file, m_version, *m_imported, *m_module,
+            m_procs.size(), lazy_proc.id, m_code, label_fixups, proc_fixups,
+            this, nullptr);
+    if (size == 0) return nullptr;
+    assert(proc_fixups.empty());
+
+    /*
+     * The code needs only its own cell, not a Proc.  Nothing refers to it
+     * until the stub jumps to it and the closures are updated below, but
+     * nothing between here and there allocates so it can't be collected.
+     * After that the stub's jump target and the closures keep it alive.
+     */
+    uint8_t *code;
+    {
+        NoGCScope no_gc(&gc_cap);
+        code = static_cast<uint8_t*>(no_gc.alloc_bytes(size));
+        no_gc.abort_if_oom("loading a procedure");
+    }
+    memcpy(code, m_code.data(), size);
+    link_labels(code, label_fixups);
+    lazy_proc.code = code;
+
+    /*
+     * Turn the stub into a jump to the code, for callers that still refer
+     * to it, and update any closures so that they skip the stub.
+     */
+    uint8_t *stub = m_module->proc(lazy_proc.id)->code();
+    ImmediateValue imm;
+    imm.word = reinterpret_cast<uintptr_t>(code);
+    write_instr(stub, 0, PZI_JMP, IMT_LABEL_REF, imm);
+
+    bool is_entry = false;
+    for (Closure *closure : m_proc_closures[lazy_proc.id]) {
+        closure->set_code(code);
+        is_entry = is_entry || closure == m_entry_closure;
+    }
+
+    if (AllocProfile *profile = m_pz.alloc_profile()) {
+        profile->add_proc(proc_name(m_file->filename(), lazy_proc.id,
+                    is_entry),
+                code, size);
+    }
+
+    return code;
+}
+
+void
+LazyLoader::do_trace(HeapMarkState *marker) const
+{
+    if (m_module) {
+        m_module->do_trace(marker);
+    }
+}
+
+} // namespace pz
@@ -9,11 +9,109 @@
 #ifndef PZ_READ_H
 #define PZ_READ_H
 
+#include <memory>
+#include <string>
+#include <vector>
+
 namespace pz {
 
+class BinaryInput;
+class Closure;
+class GCCapability;
+class HeapMarkState;
+class Module;
+class ModuleLoading;
+class PZ;
+struct PZ_Imported;
+
 Module *
 read(PZ &pz, const std::string &filename, bool verbose);
 
+/*
+ * Return the module called name, reading it first if it hasn't been read
+ * yet.  It's read from name.pz in the same directory as importer, the
+ * file that imports it.  Each module is read once and then shared by every
+ * module that imports it.
+ */
+Module *
+load_module(PZ &pz, const std::string &name, const std::string &importer,
+        bool verbose);
+
+class LazyLoader;
+
+/*
+ * A procedure that is decoded the first time it is called.
+ */
+struct LazyProc {
+    LazyLoader     *loader;
+    unsigned        id;
+    // The procedure's offset within the PZ file.
+    unsigned long   offset;
+    // Null until the procedure is decoded.
+    uint8_t        *code;
+};
+
+/*
+ * With the lazy_load option procedures aren't decoded while the module is
+ * read.  Instead each procedure's code is a stub, a PZT_LOAD_PROC
+ * instruction whose immediate value is the procedure's LazyProc.  When
+ * the stub is executed the interpreter calls load() to decode the
+ * procedure, the stub is then rewritten into a jump to the decoded code.
+ *
+ * The loader keeps the PZ file open, and the ModuleLoading alive, for as
+ * long as the module exists.
+ */
+class LazyLoader {
+  private:
+    PZ                              &m_pz;
+    std::unique_ptr<BinaryInput>     m_file;
+    // The file's format version.
+    unsigned                         m_version;
+    std::unique_ptr<PZ_Imported>     m_imported;
+    std::unique_ptr<ModuleLoading>   m_module;
+    std::vector<LazyProc>            m_procs;
+    // The closures of each procedure, they're updated to point to the
+    // decoded code.
+    std::vector<std::vector<Closure*>>  m_proc_closures;
+    Closure                         *m_entry_closure;
+    // Scratch space for decoding procedures.
+    std::vector<uint8_t>             m_code;
+
+  public:
+    explicit LazyLoader(PZ &pz);
+    ~LazyLoader();
+
+    /*
+     * Called by the reader to set up the loader.  add_stub creates the
+     * stub for the next procedure, whose code begins at offset.
+     */
+    void reserve_procs(unsigned num_procs);
+    bool add_stub(ModuleLoading &module, unsigned long offset);
+    void add_closure(unsigned proc_id, Closure *closure);
+    void set_imported(std::unique_ptr<PZ_Imported> imported);
+    void set_file(std::unique_ptr<BinaryInput> file, unsigned version);
+    void set_module(std::unique_ptr<ModuleLoading> module,
+            Closure *entry_closure);
+
+    /*
+     * The address to use for a reference to a procedure, its stub until
+     * it's decoded.
+     */
+    uint8_t * proc_code(unsigned proc_id) const;
+
+    /*
+     * Decode and link the procedure, returning the address of its code.
+     * Allocation uses gc_cap, which must be able to trace the running
+     * program.
+     */
+    uint8_t * load(LazyProc &proc, GCCapability &gc_cap);
+
+    void do_trace(HeapMarkState *marker) const;
+
+    LazyLoader(const LazyLoader&) = delete;
+    void operator=(const LazyLoader&) = delete;
+};
+
 } // namespace pz
 
 #endif /* ! PZ_READ_H */
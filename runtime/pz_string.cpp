@@ -0,0 +1,225 @@
+/*
+ * Plasma strings
+ * vim: ts=4 sw=4 et
+ *
+ * Copyright (C) 2019 Plasma Team
+ * Distributed under the terms of the MIT license, see ../LICENSE.code
+ */
+
+#include <string.h>
+
+#include <new>
+
+#include "pz_common.h"
+
+#include "pz_data.h"
+#include "pz_string.h"
+
+namespace pz {
+
+String *
+String::alloc(GCCapability &gc_cap, uint32_t length)
+{
+    assert(length <= Max_Length);
+    void *mem = gc_cap.alloc_bytes(alloc_size(length));
+    if (!mem) return nullptr;
+
+    String *string = new(mem) String(length);
+    string->data()[length] = 0;
+    return string;
+}
+
+String *
+String::from_int(GCCapability &gc_cap, int64_t num)
+{
+    unsigned length = format_int_length(num);
+    String *string = alloc(gc_cap, length);
+    if (!string) return nullptr;
+
+    format_int(num, length, string->data());
+    return string;
+}
+
+String *
+String::alloc_constant(DataArena &arena, uint32_t length)
+{
+    // The arena's memory is already zeroed, including the null byte.
+    void *mem = arena.alloc(alloc_size(length));
+    if (!mem) return nullptr;
+
+    return new(mem) String(length);
+}
+
+String *
+String::concat(GCCapability &gc_cap, String *s1, String *s2)
+{
+    uint32_t len1 = s1->length();
+    uint32_t len2 = s2->length();
+    assert(len1 <= Max_Length - len2);
+
+    if (len1 == 0) return s2;
+    if (len2 == 0) return s1;
+
+    if (len1 + len2 < Rope_Min_Length) {
+        String *flat = alloc(gc_cap, len1 + len2);
+        if (!flat) return nullptr;
+        char *dest = flat->data();
+        s1->for_each_piece([&dest](const char *bytes, uint32_t len) {
+            memcpy(dest, bytes, len);
+            dest += len;
+        });
+        s2->for_each_piece([&dest](const char *bytes, uint32_t len) {
+            memcpy(dest, bytes, len);
+            dest += len;
+        });
+        return flat;
+    }
+
+    void *mem = gc_cap.alloc_bytes(rope_alloc_size());
+    if (!mem) return nullptr;
+
+    String *rope = new(mem) String((len1 + len2) | Rope_Bit);
+    rope->rope_fields()->left = s1;
+    rope->rope_fields()->right = s2;
+    return rope;
+}
+
+String *
+String::flatten(GCCapability &gc_cap)
+{
+    if (!is_rope()) return this;
+
+    RopeFields *fields = rope_fields();
+    if (!fields->right) return fields->left;
+
+    String *flat = alloc(gc_cap, length());
+    if (!flat) return nullptr;
+    char *dest = flat->data();
+    for_each_piece([&dest](const char *bytes, uint32_t len) {
+        memcpy(dest, bytes, len);
+        dest += len;
+    });
+
+    fields->left = flat;
+    fields->right = nullptr;
+    return flat;
+}
+
+std::string
+String::to_std_string() const
+{
+    std::string result;
+    result.reserve(length());
+    for_each_piece([&result](const char *bytes, uint32_t len) {
+        result.append(bytes, len);
+    });
+    return result;
+}
+
+/*
+ * 32 bit FNV-1a, with zero reserved to mean that the hash hasn't been
+ * computed.  It's computed piece-by-piece so that ropes and flat strings
+ * with the same contents have the same hash.
+ */
+static const uint32_t FNV_Offset_Basis = 2166136261u;
+
+static uint32_t
+fnv_update(uint32_t hash, const char *chars, uint32_t len)
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(chars);
+    for (uint32_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+uint32_t
+String::compute_hash() const
+{
+    uint32_t hash = FNV_Offset_Basis;
+
+    for_each_piece([&hash](const char *chars, uint32_t len) {
+        hash = fnv_update(hash, chars, len);
+    });
+
+    return hash ? hash : 1;
+}
+
+uint32_t
+String::hash_bytes(const char *bytes, uint32_t len)
+{
+    uint32_t hash = fnv_update(FNV_Offset_Basis, bytes, len);
+    return hash ? hash : 1;
+}
+
+/*
+ * Integers are written two digits at a time from this table, working
+ * backwards from the end of the number.
+ */
+static const char Digit_Pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/*
+ * The magnitude of num, INT64_MIN's magnitude doesn't fit in an int64_t.
+ */
+static uint64_t
+magnitude(int64_t num)
+{
+    return num < 0 ? 0 - uint64_t(num) : uint64_t(num);
+}
+
+unsigned
+format_int_length(int64_t num)
+{
+    uint64_t value = magnitude(num);
+    unsigned length = num < 0 ? 2 : 1;
+
+    // Count four digits at a time then finish off the rest.
+    while (value >= 10000) {
+        value /= 10000;
+        length += 4;
+    }
+    if (value >= 1000) return length + 3;
+    if (value >= 100) return length + 2;
+    if (value >= 10) return length + 1;
+    return length;
+}
+
+void
+format_int(int64_t num, unsigned length, char *dest)
+{
+    uint64_t  value = magnitude(num);
+    char     *cur = dest + length;
+
+    while (value >= 100) {
+        unsigned pair = (value % 100) * 2;
+        value /= 100;
+        cur -= 2;
+        cur[0] = Digit_Pairs[pair];
+        cur[1] = Digit_Pairs[pair + 1];
+    }
+    if (value >= 10) {
+        unsigned pair = value * 2;
+        cur -= 2;
+        cur[0] = Digit_Pairs[pair];
+        cur[1] = Digit_Pairs[pair + 1];
+    } else {
+        *--cur = '0' + value;
+    }
+
+    if (num < 0) {
+        *--cur = '-';
+    }
+    assert(cur == dest);
+}
+
+} // namespace pz
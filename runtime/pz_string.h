@@ -0,0 +1,217 @@
+/*
+ * Plasma strings
+ * vim: ts=4 sw=4 et
+ *
+ * Copyright (C) 2019 Plasma Team
+ * Distributed under the terms of the MIT license, see ../LICENSE.code
+ */
+
+#ifndef PZ_STRING_H
+#define PZ_STRING_H
+
+#include <string>
+#include <vector>
+
+#include "pz_gc_util.h"
+
+namespace pz {
+
+class DataArena;
+
+/*
+ * A string is a header, giving its length and hash, followed by either its
+ * bytes and a null byte, or for a rope, pointers to two other strings that
+ * it is the concatenation of.  Flat strings may contain null bytes of their
+ * own, the extra one lets c_str() be passed to C functions that don't mind
+ * stopping early.
+ *
+ * Concatenating long strings makes ropes so that building a string
+ * piece-by-piece doesn't copy everything built so far each time.  Code
+ * that needs the bytes in one place must check is_rope() and flatten()
+ * the string first, or visit its pieces with for_each_piece().
+ *
+ * String values point to the header since the GC only recognises pointers
+ * to the beginning of a cell, the same goes for a rope's children.
+ *
+ * A string's hash is computed the first time it's needed, except for
+ * constant strings whose hash is computed as they're loaded since the
+ * data arena may be read-only afterwards.
+ */
+class String {
+  private:
+    // The top bit of m_length is set for ropes.
+    uint32_t    m_length;
+    // Zero until the hash has been computed.
+    uint32_t    m_hash;
+
+    static constexpr uint32_t Rope_Bit = 0x80000000u;
+
+    struct RopeFields {
+        String     *left;
+        // Null once the rope has been flattened, left is then the flat
+        // string.
+        String     *right;
+    };
+
+    explicit String(uint32_t length) : m_length(length), m_hash(0) {}
+
+    RopeFields * rope_fields() {
+        return reinterpret_cast<RopeFields*>(this + 1);
+    }
+    const RopeFields * rope_fields() const {
+        return reinterpret_cast<const RopeFields*>(this + 1);
+    }
+
+  public:
+    static constexpr uint32_t Max_Length = Rope_Bit - 1;
+
+    /*
+     * Concatenations shorter than this are copied rather than making a
+     * rope.
+     */
+    static constexpr uint32_t Rope_Min_Length = 64;
+
+    /*
+     * Allocate a flat string of length bytes on the heap, the caller
+     * writes its bytes into data().
+     */
+    static String * alloc(GCCapability &gc_cap, uint32_t length);
+
+    /*
+     * Allocate a flat string holding num in decimal.
+     */
+    static String * from_int(GCCapability &gc_cap, int64_t num);
+
+    /*
+     * Allocate a constant string in a module's data arena, returns null if
+     * there's no memory.
+     */
+    static String * alloc_constant(DataArena &arena, uint32_t length);
+
+    static size_t alloc_size(uint32_t length) {
+        return sizeof(String) + length + 1;
+    }
+
+    static constexpr size_t rope_alloc_size() {
+        return sizeof(String) + sizeof(RopeFields);
+    }
+
+    /*
+     * Return the concatenation of s1 and s2, either as a new flat string or
+     * as a rope.  The combined length must not exceed Max_Length.
+     */
+    static String * concat(GCCapability &gc_cap, String *s1, String *s2);
+
+    uint32_t length() const { return m_length & ~Rope_Bit; }
+
+    bool is_rope() const { return m_length & Rope_Bit; }
+
+    /*
+     * True if flatten() wouldn't need to copy the string.
+     */
+    bool is_flat() const {
+        return !is_rope() || !rope_fields()->right;
+    }
+
+    /*
+     * The bytes of a flat string.
+     */
+    char * data() {
+        assert(!is_rope());
+        return reinterpret_cast<char*>(this + 1);
+    }
+    const char * c_str() const {
+        assert(!is_rope());
+        return reinterpret_cast<const char*>(this + 1);
+    }
+
+    /*
+     * Return a flat string with the same contents.  A flattened rope
+     * remembers its flat version so this only copies the bytes once.
+     */
+    String * flatten(GCCapability &gc_cap);
+
+    /*
+     * Copy the string, which may be a rope, into a std::string.
+     */
+    std::string to_std_string() const;
+
+    /*
+     * Call f(const char *bytes, uint32_t len) for each flat piece of the
+     * string in order.  The rope is walked with an explicit stack since
+     * strings built by appending are very deep.
+     */
+    template<typename F>
+    void for_each_piece(F f) const;
+
+    /*
+     * The hash if it has already been computed, otherwise zero.
+     */
+    uint32_t known_hash() const { return m_hash; }
+
+    /*
+     * The hash that a string with these bytes would have.
+     */
+    static uint32_t hash_bytes(const char *bytes, uint32_t len);
+
+    uint32_t hash() {
+        if (!m_hash) {
+            m_hash = compute_hash();
+        }
+        return m_hash;
+    }
+
+    String(const String &) = delete;
+    void operator=(const String &) = delete;
+
+  private:
+    uint32_t compute_hash() const;
+};
+
+/*
+ * The most characters needed to write a 64 bit integer in decimal,
+ * including its sign.
+ */
+constexpr unsigned Max_Int_Chars = 20;
+
+/*
+ * The number of characters needed to write num in decimal.
+ */
+unsigned
+format_int_length(int64_t num);
+
+/*
+ * Write num in decimal to dest, which has room for exactly length
+ * characters as returned by format_int_length().  No null byte is written.
+ */
+void
+format_int(int64_t num, unsigned length, char *dest);
+
+template<typename F>
+void
+String::for_each_piece(F f) const
+{
+    if (!is_rope()) {
+        f(c_str(), length());
+        return;
+    }
+
+    std::vector<const String*> todo;
+    todo.push_back(this);
+    while (!todo.empty()) {
+        const String *cur = todo.back();
+        todo.pop_back();
+
+        if (cur->is_rope()) {
+            const RopeFields *fields = cur->rope_fields();
+            if (fields->right) todo.push_back(fields->right);
+            todo.push_back(fields->left);
+        } else if (cur->length()) {
+            f(cur->c_str(), cur->length());
+        }
+    }
+}
+
+} // namespace pz
+
+#endif /* ! PZ_STRING_H */
@@ -0,0 +1,403 @@
+/*
+ * Plasma bytecode verifier
+ * vim: ts=4 sw=4 et
+ *
+ * Copyright (C) 2019 Plasma Team
+ * Distributed under the terms of the MIT license, see ../LICENSE.code
+ */
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <map>
+
+#include "pz_common.h"
+
+#include "pz_data.h"
+#include "pz_module.h"
+#include "pz_verify.h"
+
+namespace pz {
+
+namespace {
+
+enum ControlKind {
+    CK_NEXT,        // Control continues with the next instruction.
+    CK_CALL,        // A non-tail call, the depth afterwards is unknown.
+    CK_BRANCH,      // Either the label or the next instruction.
+    CK_JUMP,        // The label.
+    CK_RETURN       // Control leaves the procedure.
+};
+
+struct StackEffect {
+    unsigned        pops;
+    unsigned        pushes;
+    ControlKind     control;
+};
+
+struct Anchor {
+    unsigned    block;
+    unsigned    instr;
+    int         max_depth;
+};
+
+/*
+ * The depth of the stack at the beginning of a block, relative to an
+ * anchor.  anchor is -1 if the block hasn't been reached yet.
+ */
+struct BlockState {
+    int     anchor;
+    int     depth;
+};
+
+class Verifier {
+  private:
+    const std::string           &m_filename;
+    unsigned                     m_proc_id;
+    const std::vector<RawBlock> &m_blocks;
+    const VerifyInfo            &m_info;
+
+    std::vector<Anchor>          m_anchors;
+    std::vector<BlockState>      m_block_states;
+    // True for blocks that begin with their own anchor.
+    std::vector<bool>            m_block_anchored;
+    std::map<std::pair<unsigned, unsigned>, unsigned>  m_anchor_ids;
+    std::vector<unsigned>        m_worklist;
+    bool                         m_has_calls;
+
+  public:
+    Verifier(const std::string &filename, unsigned proc_id,
+            const std::vector<RawBlock> &blocks, const VerifyInfo &info) :
+        m_filename(filename),
+        m_proc_id(proc_id),
+        m_blocks(blocks),
+        m_info(info),
+        m_block_states(blocks.size(), {-1, 0}),
+        m_block_anchored(blocks.size(), false),
+        m_has_calls(false) {}
+
+    bool verify(std::vector<StackCheck> &checks);
+
+  private:
+    bool check_instr(unsigned block, unsigned instr_num,
+            const RawInstr &instr);
+    bool stack_block(unsigned block);
+    bool merge(unsigned from_block, unsigned from_instr, unsigned to_block,
+            BlockState state);
+    unsigned new_anchor(unsigned block, unsigned instr);
+
+    bool error(unsigned block, unsigned instr, const char *message);
+};
+
+} // anonymous namespace
+
+static StackEffect
+stack_effect(const RawInstr &instr);
+
+bool
+verify_proc(const std::string           &filename,
+            unsigned                     proc_id,
+            const std::vector<RawBlock> &blocks,
+            const VerifyInfo            &info,
+            std::vector<StackCheck>     &checks)
+{
+    Verifier verifier(filename, proc_id, blocks, info);
+    return verifier.verify(checks);
+}
+
+bool
+Verifier::verify(std::vector<StackCheck> &checks)
+{
+    checks.clear();
+
+    if (m_blocks.empty()) {
+        fprintf(stderr, "%s: procedure %u: Procedure has no blocks\n",
+                m_filename.c_str(), m_proc_id);
+        return false;
+    }
+
+    for (unsigned b = 0; b < m_blocks.size(); b++) {
+        for (unsigned i = 0; i < m_blocks[b].size(); i++) {
+            if (!check_instr(b, i, m_blocks[b][i])) return false;
+        }
+    }
+
+    m_block_states[0] = {int(new_anchor(0, 0)), 0};
+    m_block_anchored[0] = true;
+    m_worklist.push_back(0);
+    while (!m_worklist.empty()) {
+        unsigned block = m_worklist.back();
+        m_worklist.pop_back();
+        if (!stack_block(block)) return false;
+    }
+
+    for (unsigned a = 0; a < m_anchors.size(); a++) {
+        const Anchor &anchor = m_anchors[a];
+        if (anchor.max_depth > 0 || (a == 0 && m_has_calls)) {
+            checks.push_back({anchor.block, anchor.instr,
+                    unsigned(std::max(anchor.max_depth, 0))});
+        }
+    }
+    std::sort(checks.begin(), checks.end(),
+            [](const StackCheck &a, const StackCheck &b) {
+                return a.block < b.block ||
+                    (a.block == b.block && a.instr < b.instr);
+            });
+
+    return true;
+}
+
+/*
+ * Check the instruction's widths and references.
+ */
+bool
+Verifier::check_instr(unsigned block, unsigned instr_num,
+        const RawInstr &instr)
+{
+    switch (instr.opcode) {
+        case PZI_ZE:
+        case PZI_SE:
+            if (width_normalize(instr.width1) >
+                    width_normalize(instr.width2))
+            {
+                return error(block, instr_num,
+                        "Extension to a narrower width");
+            }
+            break;
+        case PZI_TRUNC:
+            if (width_normalize(instr.width1) <
+                    width_normalize(instr.width2))
+            {
+                return error(block, instr_num,
+                        "Truncation to a wider width");
+            }
+            break;
+        case PZI_ROLL:
+        case PZI_PICK:
+            if (instr.immediate.uint8 == 0) {
+                return error(block, instr_num, "Stack depth of zero");
+            }
+            break;
+        case PZI_TCALL_IMPORT:
+            return error(block, instr_num,
+                    "Tail calls to imports are unsupported");
+        default:
+            break;
+    }
+
+    switch (instruction_info[instr.opcode].ii_immediate_type) {
+        case IMT_CLOSURE_REF:
+            if (instr.immediate.uint32 >= m_info.module.num_closures()) {
+                return error(block, instr_num, "Bad closure reference");
+            }
+            break;
+        case IMT_PROC_REF:
+            if (instr.immediate.uint32 >= m_info.num_procs) {
+                return error(block, instr_num, "Bad procedure reference");
+            }
+            break;
+        case IMT_IMPORT_REF:
+        case IMT_IMPORT_CLOSURE_REF:
+            if (instr.immediate.uint32 >= m_info.num_imports) {
+                return error(block, instr_num, "Bad import reference");
+            }
+            break;
+        case IMT_STRUCT_REF:
+            if (instr.immediate.uint32 >= m_info.module.num_structs()) {
+                return error(block, instr_num, "Bad struct reference");
+            }
+            break;
+        case IMT_STRUCT_REF_FIELD:
+            if (instr.immediate.uint32 >= m_info.module.num_structs()) {
+                return error(block, instr_num, "Bad struct reference");
+            }
+            if (instr.field >= m_info.module.struct_(
+                        instr.immediate.uint32)->num_fields())
+            {
+                return error(block, instr_num, "Bad field number");
+            }
+            break;
+        case IMT_LABEL_REF:
+            if (instr.immediate.uint32 >= m_blocks.size()) {
+                return error(block, instr_num, "Bad label");
+            }
+            break;
+        case IMT_NONE:
+        case IMT_8:
+        case IMT_16:
+        case IMT_32:
+        case IMT_64:
+            break;
+    }
+
+    return true;
+}
+
+/*
+ * Follow the stack depth through a block, and on to its successors.
+ */
+bool
+Verifier::stack_block(unsigned block)
+{
+    BlockState state = m_block_states[block];
+    const RawBlock &instrs = m_blocks[block];
+
+    for (unsigned i = 0; i < instrs.size(); i++) {
+        const RawInstr &instr = instrs[i];
+        StackEffect effect = stack_effect(instr);
+
+        state.depth += int(effect.pushes) - int(effect.pops);
+        Anchor &anchor = m_anchors[state.anchor];
+        anchor.max_depth = std::max(anchor.max_depth, state.depth);
+
+        switch (effect.control) {
+            case CK_NEXT:
+                break;
+            case CK_CALL:
+                m_has_calls = true;
+                state = {int(new_anchor(block, i + 1)), 0};
+                break;
+            case CK_BRANCH:
+                if (!merge(block, i, instr.immediate.uint32, state)) {
+                    return false;
+                }
+                break;
+            case CK_JUMP:
+                return merge(block, i, instr.immediate.uint32, state);
+            case CK_RETURN:
+                return true;
+        }
+    }
+
+    // Execution can't fall through to the next block.
+    return error(block, instrs.size(),
+            "Block doesn't end with a jump, return or tail call");
+}
+
+bool
+Verifier::merge(unsigned from_block, unsigned from_instr, unsigned to_block,
+        BlockState state)
+{
+    BlockState &to = m_block_states[to_block];
+
+    if (m_block_anchored[to_block]) {
+        return true;
+    }
+
+    if (to.anchor < 0) {
+        to = state;
+        m_worklist.push_back(to_block);
+    } else if (to.anchor == state.anchor) {
+        if (to.depth != state.depth) {
+            return error(from_block, from_instr,
+                    "Inconsistent stack depth at a branch target");
+        }
+    } else {
+        /*
+         * The block is reached from two places whose depths we can't
+         * compare, start again from a new anchor.
+         */
+        m_block_anchored[to_block] = true;
+        to = {int(new_anchor(to_block, 0)), 0};
+        m_worklist.push_back(to_block);
+    }
+
+    return true;
+}
+
+unsigned
+Verifier::new_anchor(unsigned block, unsigned instr)
+{
+    auto key = std::make_pair(block, instr);
+    auto iter = m_anchor_ids.find(key);
+    if (iter != m_anchor_ids.end()) {
+        return iter->second;
+    }
+
+    unsigned id = m_anchors.size();
+    m_anchors.push_back({block, instr, 0});
+    m_anchor_ids[key] = id;
+    return id;
+}
+
+bool
+Verifier::error(unsigned block, unsigned instr, const char *message)
+{
+    fprintf(stderr, "%s: procedure %u, block %u, instruction %u: %s\n",
+            m_filename.c_str(), m_proc_id, block, instr, message);
+    return false;
+}
+
+static StackEffect
+stack_effect(const RawInstr &instr)
+{
+    switch (instr.opcode) {
+        case PZI_LOAD_IMMEDIATE_NUM:
+        case PZI_ALLOC:
+        case PZI_GET_ENV:
+            return {0, 1, CK_NEXT};
+        case PZI_ZE:
+        case PZI_SE:
+        case PZI_TRUNC:
+        case PZI_NOT:
+        case PZI_MAKE_CLOSURE:
+            return {1, 1, CK_NEXT};
+        case PZI_ADD:
+        case PZI_SUB:
+        case PZI_MUL:
+        case PZI_DIV:
+        case PZI_MOD:
+        case PZI_LSHIFT:
+        case PZI_RSHIFT:
+        case PZI_AND:
+        case PZI_OR:
+        case PZI_XOR:
+        case PZI_LT_U:
+        case PZI_LT_S:
+        case PZI_GT_U:
+        case PZI_GT_S:
+        case PZI_EQ:
+            return {2, 1, CK_NEXT};
+        case PZI_DROP:
+            return {1, 0, CK_NEXT};
+        case PZI_ROLL:
+            return {instr.immediate.uint8, instr.immediate.uint8, CK_NEXT};
+        case PZI_PICK:
+            return {instr.immediate.uint8,
+                unsigned(instr.immediate.uint8) + 1, CK_NEXT};
+        case PZI_LOAD:
+        case PZI_LOAD_NAMED:
+            // (ptr - value ptr)
+            return {1, 2, CK_NEXT};
+        case PZI_STORE:
+            // (value ptr - ptr)
+            return {2, 1, CK_NEXT};
+        case PZI_CALL:
+        case PZI_CALL_IMPORT:
+        case PZI_CALL_PROC:
+            return {0, 0, CK_CALL};
+        case PZI_CALL_IND:
+            return {1, 0, CK_CALL};
+        case PZI_CJMP:
+            return {1, 0, CK_BRANCH};
+        case PZI_JMP:
+            return {0, 0, CK_JUMP};
+        case PZI_TCALL:
+        case PZI_TCALL_IMPORT:
+        case PZI_TCALL_IND:
+        case PZI_TCALL_PROC:
+        case PZI_RET:
+            return {0, 0, CK_RETURN};
+        case PZI_END:
+        case PZI_CCALL:
+        case PZI_CCALL_ALLOC:
+        case PZI_CCALL_SPECIAL:
+        case PZI_LOAD_PROC:
+        case PZI_CHECK_STACK:
+            break;
+    }
+    fprintf(stderr, "Opcode %d doesn't appear in bytecode\n", instr.opcode);
+    abort();
+}
+
+} // namespace pz
@@ -0,0 +1,88 @@
+/*
+ * Plasma bytecode verifier
+ * vim: ts=4 sw=4 et
+ *
+ * Copyright (C) 2019 Plasma Team
+ * Distributed under the terms of the MIT license, see ../LICENSE.code
+ */
+
+#ifndef PZ_VERIFY_H
+#define PZ_VERIFY_H
+
+#include <string>
+#include <vector>
+
+#include "pz_format.h"
+#include "pz_instructions.h"
+
+namespace pz {
+
+class ModuleLoading;
+
+/*
+ * An instruction as it appears in a PZ file.  References are still the
+ * IDs from the file.
+ */
+struct RawInstr {
+    PZ_Opcode       opcode;
+    PZ_Width        width1;
+    PZ_Width        width2;
+    ImmediateValue  immediate;
+    // The field number of an IMT_STRUCT_REF_FIELD.
+    uint8_t         field;
+};
+
+typedef std::vector<RawInstr> RawBlock;
+
+/*
+ * The number of items in the module being read that instructions may
+ * refer to.
+ */
+struct VerifyInfo {
+    const ModuleLoading    &module;
+    unsigned                num_procs;
+    unsigned                num_imports;
+};
+
+/*
+ * A stack check to be inserted before instruction instr of block, it
+ * checks that depth more items will fit on the expression stack.
+ */
+struct StackCheck {
+    unsigned    block;
+    unsigned    instr;
+    unsigned    depth;
+};
+
+/*
+ * Verify a procedure before it's decoded.  The verifier checks that each
+ * instruction's widths and references are valid and that, between calls,
+ * the expression stack has the same depth each time control reaches an
+ * instruction.
+ *
+ * Since the PZ format doesn't describe procedures' signatures the
+ * verifier can't know how a call changes the stack depth.  Instead the
+ * depth is measured relative to an anchor: the procedure's entry, the
+ * instruction after each call, or a block whose predecessors disagree
+ * about the anchor.  checks is set to one check for each anchor that
+ * the stack grows by, plus one at the entry if the procedure makes
+ * non-tail calls (which need room on the return stack).
+ *
+ * The checks after calls can't be made by the call instruction instead:
+ * the callee may return more items than it was passed, and builtins
+ * called through closures leave no guarantee about the room left after
+ * they return.  A check costs one dispatch, anchors that don't grow the
+ * stack (such as a call followed by add and ret) have none.
+ *
+ * Returns false, after printing a message, if the procedure is invalid.
+ */
+bool
+verify_proc(const std::string           &filename,
+            unsigned                     proc_id,
+            const std::vector<RawBlock> &blocks,
+            const VerifyInfo            &info,
+            std::vector<StackCheck>     &checks);
+
+} // namespace pz
+
+#endif /* ! PZ_VERIFY_H */
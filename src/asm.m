@@ -26,6 +26,7 @@
 
 :- implementation.
 
+:- import_module assoc_list.
 :- import_module bimap.
 :- import_module cord.
 :- import_module digraph.
@@ -158,6 +159,7 @@ prepare_map_2(asm_item(QName, Context, Type), !SymMap, !StructMap, !PZ) :-
         % Already handled above.
     ).
 prepare_map_2(asm_entrypoint(_, _), !SymMap, !StructMap, !PZ).
+prepare_map_2(asm_export(_, _), !SymMap, !StructMap, !PZ).
 
 :- pred build_items(bimap(q_name, pz_item_id)::in, map(string, pzs_id)::in,
     asm_item::in, pz::in, pz::out) is det.
@@ -198,6 +200,7 @@ build_items(SymbolMap, StructMap, asm_item(Name, Context, Type), !PZ) :-
                         "Data length doesn't match struct length")
                 )
             ; DType = type_array(_)
+            ; DType = type_string
             ),
             Values = map(build_data_value(SymbolMap), ASMValues),
             pz_add_data(DID, pz_data(DType, Values), !PZ)
@@ -213,6 +216,18 @@ build_items(Map, _StructMap, asm_entrypoint(_, Name), !PZ) :-
     lookup(Map, Name, ID),
     CID = item_expect_closure($file, $pred, ID),
     pz_set_entry_closure(CID, !PZ).
+build_items(Map, _StructMap, asm_export(Context, Name), !PZ) :-
+    ( if search(Map, Name, ID) then
+        CID = item_expect_closure($file, $pred, ID),
+        ExportName = q_name_unqual(Name),
+        ( if search(pz_get_exports(!.PZ), ExportName, _) then
+            compile_error($file, $pred, Context, "Duplicate export")
+        else
+            pz_export_closure(CID, ExportName, !PZ)
+        )
+    else
+        compile_error($file, $pred, Context, "Unknown closure")
+    ).
 
 :- pred build_block_map(pzt_block::in, int::in, int::out,
     map(string, int)::in, map(string, int)::out,
@@ -397,6 +412,7 @@ builtin_instr("get_env",    _,  _,  pzi_get_env).
     pz_data_type.
 
 build_data_type(_,   asm_dtype_array(Width)) = type_array(Width).
+build_data_type(_,   asm_dtype_string) = type_string.
 build_data_type(Map, asm_dtype_struct(Name)) = type_struct(ID) :-
     ( if map.search(Map, Name, IDPrime) then
         ID = IDPrime
@@ -46,6 +46,10 @@
     ;       asm_entrypoint(
                 asme_context   :: context,
                 asme_name      :: q_name
+            )
+    ;       asm_export(
+                asmx_context   :: context,
+                asmx_name      :: q_name
             ).
 
     % There are currently two entry types.
@@ -78,7 +82,8 @@
     --->    asm_dtype_array(pz_width)
             % Note that this is a string and it is not possible to refer to
             % structs in other modules.
-    ;       asm_dtype_struct(string).
+    ;       asm_dtype_struct(string)
+    ;       asm_dtype_string.
 
 :- type asm_data_value
     --->    asm_dvalue_num(int)
@@ -371,6 +371,17 @@ setup_misc_builtins(BoolType, BoolTrue, BoolFalse, !Map, !Core) :-
             [builtin_type(string)], [], [], set([RIO]), init),
         _, !Map, !Core),
 
+    FlushName = q_name_append_str(builtin_module_name, "flush"),
+    register_builtin_func(q_name("flush"),
+        func_init_builtin_rts(FlushName, [], [], [], set([RIO]), init),
+        _, !Map, !Core),
+
+    PrintIntName = q_name_append_str(builtin_module_name, "print_int"),
+    register_builtin_func(q_name("print_int"),
+        func_init_builtin_rts(PrintIntName,
+            [builtin_type(int)], [], [], set([RIO]), init),
+        _, !Map, !Core),
+
     IntToStringName = q_name_append_str(builtin_module_name, "int_to_string"),
     register_builtin_func(q_name("int_to_string"),
         func_init_builtin_rts(IntToStringName,
@@ -431,6 +442,29 @@ setup_misc_builtins(BoolType, BoolTrue, BoolFalse, !Map, !Core) :-
             init, init),
         _, !Map, !Core),
 
+    FlattenStringName = q_name_append_str(builtin_module_name,
+        "flatten_string"),
+    register_builtin_func(q_name("flatten_string"),
+        func_init_builtin_rts(FlattenStringName,
+            [builtin_type(string)], [builtin_type(string)], [],
+            init, init),
+        _, !Map, !Core),
+
+    register_string_builtin("string_equals",
+        [builtin_type(string), builtin_type(string)],
+        [type_ref(BoolType, [])], !Map, !Core),
+    register_string_builtin("string_compare",
+        [builtin_type(string), builtin_type(string)],
+        [builtin_type(int)], !Map, !Core),
+    register_string_builtin("string_find",
+        [builtin_type(string), builtin_type(string)],
+        [builtin_type(int)], !Map, !Core),
+    register_string_builtin("string_starts_with",
+        [builtin_type(string), builtin_type(string)],
+        [type_ref(BoolType, [])], !Map, !Core),
+    register_string_builtin("string_hash",
+        [builtin_type(string)], [builtin_type(int)], !Map, !Core),
+
     DieName = q_name_append_str(builtin_module_name, "die"),
     register_builtin_func(DieName,
         func_init_builtin_rts(DieName, [builtin_type(string)], [], [],
@@ -439,6 +473,17 @@ setup_misc_builtins(BoolType, BoolTrue, BoolFalse, !Map, !Core) :-
 
 %-----------------------------------------------------------------------%
 
+:- pred register_string_builtin(string::in, list(type_)::in,
+    list(type_)::in,
+    map(q_name, builtin_item)::in, map(q_name, builtin_item)::out,
+    core::in, core::out) is det.
+
+register_string_builtin(Name, Params, Results, !Map, !Core) :-
+    FullName = q_name_append_str(builtin_module_name, Name),
+    register_builtin_func(q_name(Name),
+        func_init_builtin_rts(FullName, Params, Results, [], init, init),
+        _, !Map, !Core).
+
 :- pred register_builtin_func(q_name::in, function::in, func_id::out,
     map(q_name, builtin_item)::in, map(q_name, builtin_item)::out,
     core::in, core::out) is det.
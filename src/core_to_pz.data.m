@@ -150,9 +150,8 @@ gen_const_data_string(String, !LocnMap, !ModuleClo, !PZ) :-
     else
         pz_new_data_id(DID, !PZ),
         % XXX: currently ASCII.
-        Bytes = map(func(C) = pzv_num(to_int(C)), to_char_list(String)) ++
-            [pzv_num(0)],
-        Data = pz_data(type_array(pzw_8), Bytes),
+        Bytes = map(func(C) = pzv_num(to_int(C)), to_char_list(String)),
+        Data = pz_data(type_string, Bytes),
         pz_add_data(DID, Data, !PZ),
         closure_add_field(pzv_data(DID), FieldNum, !ModuleClo),
         vls_insert_str(String, closure_get_struct(!.ModuleClo), FieldNum,
@@ -50,6 +50,20 @@
 :- pred write_int64(binary_output_stream::in, int::in, int::in,
     io::di, io::uo) is det.
 
+    % write_varint(Stream, Int, !IO)
+    %
+    % Write a non-negative number as an unsigned LEB128 number.
+    %
+:- pred write_varint(binary_output_stream::in, int::in,
+    io::di, io::uo) is det.
+
+    % write_svarint(Stream, Int, !IO)
+    %
+    % Write a number as a signed LEB128 number.
+    %
+:- pred write_svarint(binary_output_stream::in, int::in,
+    io::di, io::uo) is det.
+
 %-----------------------------------------------------------------------%
 %-----------------------------------------------------------------------%
 
@@ -57,6 +71,7 @@
 
 :- import_module char.
 :- import_module int.
+:- import_module require.
 
 %-----------------------------------------------------------------------%
 
@@ -92,5 +107,35 @@ write_int64(Stream, IntHigh, IntLow, !IO) :-
     write_int32(Stream, IntHigh, !IO),
     write_int32(Stream, IntLow, !IO).
 
+write_varint(Stream, Int, !IO) :-
+    ( if Int < 0 then
+        unexpected($file, $pred, "Negative number")
+    else
+        true
+    ),
+    Byte = Int /\ 0x7F,
+    Rest = Int >> 7,
+    ( if Rest = 0 then
+        write_byte(Stream, Byte, !IO)
+    else
+        write_byte(Stream, Byte \/ 0x80, !IO),
+        write_varint(Stream, Rest, !IO)
+    ).
+
+write_svarint(Stream, Int, !IO) :-
+    Byte = Int /\ 0x7F,
+    % >> is an arithmetic shift, Rest is -1 once only sign bits remain.
+    Rest = Int >> 7,
+    ( if
+        ( Rest = 0, Byte /\ 0x40 = 0
+        ; Rest = -1, Byte /\ 0x40 \= 0
+        )
+    then
+        write_byte(Stream, Byte, !IO)
+    else
+        write_byte(Stream, Byte \/ 0x80, !IO),
+        write_svarint(Stream, Rest, !IO)
+    ).
+
 %-----------------------------------------------------------------------%
 %-----------------------------------------------------------------------%
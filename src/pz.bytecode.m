@@ -23,6 +23,10 @@
 
 :- func pzf_version = int.
 
+    % The number of sections whose offsets are given by the directory.
+    %
+:- func pzf_num_sections = int.
+
 %-----------------------------------------------------------------------%
 
 % Constants for encoding option types.
@@ -35,6 +39,7 @@
 
 :- func pzf_data_array = int.
 :- func pzf_data_struct = int.
+:- func pzf_data_string = int.
 
     % Encoding type is used for data items, it is used by the code that
     % reads/writes this static data so that it knows how to interpret each
@@ -180,6 +185,13 @@ pzf_id_string =
 
 %-----------------------------------------------------------------------%
 
+:- pragma foreign_proc("C",
+    pzf_num_sections = (X::out),
+    [will_not_call_mercury, thread_safe, promise_pure],
+    "X = PZ_NUM_SECTIONS;").
+
+%-----------------------------------------------------------------------%
+
 :- pragma foreign_proc("C",
     pzf_opt_entry_closure = (X::out),
     [will_not_call_mercury, thread_safe, promise_pure],
@@ -198,6 +210,10 @@ pzf_id_string =
     pzf_data_struct = (X::out),
     [will_not_call_mercury, thread_safe, promise_pure],
     "X = PZ_DATA_STRUCT;").
+:- pragma foreign_proc("C",
+    pzf_data_string = (X::out),
+    [will_not_call_mercury, thread_safe, promise_pure],
+    "X = PZ_DATA_STRING;").
 
 
 :- pragma foreign_enum("C", enc_type/0,
@@ -51,7 +51,9 @@
     %
 :- type pz_data_type
     --->    type_array(pz_width)
-    ;       type_struct(pzs_id).
+    ;       type_struct(pzs_id)
+            % A string's values are its bytes.
+    ;       type_string.
 
     % A static data entry
     %
@@ -131,6 +133,12 @@
 
 :- func pz_get_maybe_entry_closure(pz) = maybe(pzc_id).
 
+    % Export a closure so that other modules may import it by name.
+    %
+:- pred pz_export_closure(pzc_id::in, string::in, pz::in, pz::out) is det.
+
+:- func pz_get_exports(pz) = assoc_list(string, pzc_id).
+
 %-----------------------------------------------------------------------%
 
 :- func pz_get_structs(pz) = assoc_list(pzs_id, pz_struct).
@@ -263,6 +271,7 @@ pzc_id_get_num(pzc_id(Num)) = Num.
         pz_closures                 :: map(pzc_id, pz_closure),
         pz_next_closure_id          :: pzc_id,
         pz_maybe_entry              :: maybe(pzc_id),
+        pz_exports                  :: map(string, pzc_id),
 
         pz_errors                   :: cord(error(asm_error))
     ).
@@ -270,7 +279,7 @@ pzc_id_get_num(pzc_id(Num)) = Num.
 %-----------------------------------------------------------------------%
 
 init_pz = pz(init, pzs_id(0), init, pzi_id(0), init, pzp_id(0),
-    init, pzd_id(0), init, pzc_id(0), no, init).
+    init, pzd_id(0), init, pzc_id(0), no, init, init).
 
 %-----------------------------------------------------------------------%
 
@@ -279,6 +288,13 @@ pz_set_entry_closure(ClosureID, !PZ) :-
 
 pz_get_maybe_entry_closure(PZ) = PZ ^ pz_maybe_entry.
 
+pz_export_closure(ClosureID, Name, !PZ) :-
+    Exports0 = !.PZ ^ pz_exports,
+    map.det_insert(Name, ClosureID, Exports0, Exports),
+    !PZ ^ pz_exports := Exports.
+
+pz_get_exports(PZ) = to_assoc_list(PZ ^ pz_exports).
+
 %-----------------------------------------------------------------------%
 
 pz_get_structs(PZ) = to_assoc_list(PZ ^ pz_structs).
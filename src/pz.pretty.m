@@ -61,6 +61,7 @@ data_pretty(DID - pz_data(Type, Values)) = String :-
 
 data_type_pretty(type_array(Width)) = cons("array(",
     snoc(width_pretty(Width), ")")).
+data_type_pretty(type_string) = singleton("string").
 data_type_pretty(type_struct(StructId)) = singleton(StructName) :-
     StructName = format("struct_%d", [i(pzs_id_get_num(StructId))]).
 
@@ -73,23 +73,56 @@ write_pz_options(File, PZ, !IO) :-
 write_pz_entries(File, PZ, !IO) :-
     % Write counts of each entry type
     ImportedProcs = sort(pz_get_imports(PZ)),
-    write_int32(File, length(ImportedProcs), !IO),
+    write_varint(File, length(ImportedProcs), !IO),
     Structs = sort(pz_get_structs(PZ)),
-    write_int32(File, length(Structs), !IO),
+    write_varint(File, length(Structs), !IO),
     Datas = sort(pz_get_data_items(PZ)),
-    write_int32(File, length(Datas), !IO),
+    write_varint(File, length(Datas), !IO),
     Procs = sort(pz_get_procs(PZ)),
-    write_int32(File, length(Procs), !IO),
+    write_varint(File, length(Procs), !IO),
     Closures = sort(pz_get_closures(PZ)),
-    write_int32(File, length(Closures), !IO),
-
-    % Write the actual entries.
+    write_varint(File, length(Closures), !IO),
+    Exports = pz_get_exports(PZ),
+    write_varint(File, length(Exports), !IO),
+
+    % Reserve space for the directory, it is filled in once we know where
+    % each entry is.
+    binary_output_stream_offset(File, DirectoryOffset, !IO),
+    DirectorySize = pzf_num_sections + length(Datas) + length(Procs),
+    foldl(write_int32(File), duplicate(DirectorySize, 0), !IO),
+
+    % Write the actual entries.  The sections must be written in the same
+    % order as the PZ_Section enum.
+    binary_output_stream_offset(File, ImportsOffset, !IO),
     foldl(write_imported_proc(File), ImportedProcs, !IO),
     % TODO Write imported data.
+    binary_output_stream_offset(File, StructsOffset, !IO),
     foldl(write_struct(File), Structs, !IO),
-    foldl(write_data(File, PZ), Datas, !IO),
-    foldl(write_proc(File), Procs, !IO),
-    foldl(write_closure(File), Closures, !IO).
+    binary_output_stream_offset(File, DatasOffset, !IO),
+    map_foldl(write_with_offset(write_data(File, PZ), File), Datas,
+        DataOffsets, !IO),
+    binary_output_stream_offset(File, ProcsOffset, !IO),
+    map_foldl(write_with_offset(write_proc(File), File), Procs,
+        ProcOffsets, !IO),
+    binary_output_stream_offset(File, ClosuresOffset, !IO),
+    foldl(write_closure(File), Closures, !IO),
+    binary_output_stream_offset(File, ExportsOffset, !IO),
+    foldl(write_export(File), Exports, !IO),
+
+    seek_binary_output(File, set, DirectoryOffset, !IO),
+    foldl(write_int32(File), [ImportsOffset, StructsOffset, DatasOffset,
+        ProcsOffset, ClosuresOffset, ExportsOffset], !IO),
+    foldl(write_int32(File), DataOffsets, !IO),
+    foldl(write_int32(File), ProcOffsets, !IO),
+    seek_binary_output(File, end, 0, !IO).
+
+:- pred write_with_offset(
+    pred(T, io, io)::in(pred(in, di, uo) is det),
+    io.binary_output_stream::in, T::in, int::out, io::di, io::uo) is det.
+
+write_with_offset(Write, File, Entry, Offset, !IO) :-
+    binary_output_stream_offset(File, Offset, !IO),
+    Write(Entry, !IO).
 
 %-----------------------------------------------------------------------%
 
@@ -113,7 +146,7 @@ write_imported_proc(File, _ - QName, !IO) :-
     pair(T, pz_struct)::in, io::di, io::uo) is det.
 
 write_struct(File, _ - pz_struct(Widths), !IO) :-
-    write_int32(File, length(Widths), !IO),
+    write_varint(File, length(Widths), !IO),
     foldl(write_width(File), Widths, !IO).
 
 :- pred write_width(io.binary_output_stream::in, pz_width::in,
@@ -137,46 +170,69 @@ write_data(File, PZ, _ - pz_data(Type, Values), !IO) :-
 
 write_data_type(File, type_array(Width), Length, !IO) :-
     write_int8(File, pzf_data_array, !IO),
-    write_int16(File, Length, !IO),
+    write_varint(File, Length, !IO),
     write_width(File, Width, !IO).
 write_data_type(File, type_struct(PZSId), _, !IO) :-
     write_int8(File, pzf_data_struct, !IO),
-    write_int32(File, pzs_id_get_num(PZSId), !IO).
+    write_varint(File, pzs_id_get_num(PZSId), !IO).
+write_data_type(File, type_string, Length, !IO) :-
+    write_int8(File, pzf_data_string, !IO),
+    write_varint(File, Length, !IO).
+
+    % The elements of arrays of numbers are written without their
+    % encoding, since it follows from the array's width.
+    %
+:- type value_enc
+    --->    with_enc
+    ;       without_enc.
 
 :- pred write_data_values(io.binary_output_stream::in, pz::in, pz_data_type::in,
     list(pz_data_value)::in, io::di, io::uo) is det.
 
 write_data_values(File, PZ, Type, Values, !IO) :-
     ( Type = type_array(Width),
-        foldl(write_value(File, Width), Values, !IO)
+        ( if Width = pzw_ptr then
+            Enc = with_enc
+        else
+            Enc = without_enc
+        ),
+        foldl(write_value(File, Enc, Width), Values, !IO)
     ; Type = type_struct(PZSId),
         pz_lookup_struct(PZ, PZSId) = pz_struct(Widths),
-        foldl_corresponding(write_value(File), Widths, Values, !IO)
+        foldl_corresponding(write_value(File, with_enc), Widths, Values, !IO)
+    ; Type = type_string,
+        foldl(write_string_byte(File), Values, !IO)
     ).
 
-:- pred write_value(io.binary_output_stream::in, pz_width::in,
-    pz_data_value::in, io::di, io::uo) is det.
+:- pred write_string_byte(io.binary_output_stream::in, pz_data_value::in,
+    io::di, io::uo) is det.
 
-write_value(File, Width, Value, !IO) :-
+write_string_byte(File, Value, !IO) :-
+    ( if Value = pzv_num(Byte) then
+        write_int8(File, Byte, !IO)
+    else
+        unexpected($file, $pred, "Non-numeric string byte")
+    ).
+
+:- pred write_value(io.binary_output_stream::in, value_enc::in,
+    pz_width::in, pz_data_value::in, io::di, io::uo) is det.
+
+write_value(File, Enc, Width, Value, !IO) :-
     ( Value = pzv_num(Num),
         ( Width = pzw_8,
-            pz_enc_byte(t_normal, 1, EncByte),
-            write_int8(File, EncByte, !IO),
-            write_int8(File, Num, !IO)
+            write_enc(File, Enc, t_normal, 1, !IO),
+            write_svarint(File, sign_extend(8, Num), !IO)
         ; Width = pzw_16,
-            pz_enc_byte(t_normal, 2, EncByte),
-            write_int8(File, EncByte, !IO),
-            write_int16(File, Num, !IO)
+            write_enc(File, Enc, t_normal, 2, !IO),
+            write_svarint(File, sign_extend(16, Num), !IO)
         ; Width = pzw_32,
-            pz_enc_byte(t_normal, 4, EncByte),
-            write_int8(File, EncByte, !IO),
-            write_int32(File, Num, !IO)
+            write_enc(File, Enc, t_normal, 4, !IO),
+            write_svarint(File, sign_extend(32, Num), !IO)
         ; Width = pzw_64,
             util.sorry($file, $pred, "64bit values")
         ; Width = pzw_fast,
-            pz_enc_byte(t_wfast, 4, EncByte),
-            write_int8(File, EncByte, !IO),
-            write_int32(File, Num, !IO)
+            write_enc(File, Enc, t_wfast, 4, !IO),
+            write_svarint(File, sign_extend(32, Num), !IO)
         ; Width = pzw_ptr,
             % This could be used by tag values in the future, currently I
             % think 32bit values are used.
@@ -185,18 +241,17 @@ write_value(File, Width, Value, !IO) :-
     ;
         ( Value = pzv_data(DID),
             IdNum = pzd_id_get_num(DID),
-            Enc = t_data
+            EncType = t_data
         ; Value = pzv_import(IID),
             IdNum = pzi_id_get_num(IID),
-            Enc = t_import
+            EncType = t_import
         ; Value = pzv_closure(CID),
             IdNum = pzc_id_get_num(CID),
-            Enc = t_closure
+            EncType = t_closure
         ),
         ( Width = pzw_ptr,
-            pz_enc_byte(Enc, 4, EncByte),
-            write_int8(File, EncByte, !IO),
-            write_int32(File, IdNum, !IO)
+            write_enc(File, Enc, EncType, 4, !IO),
+            write_varint(File, IdNum, !IO)
         ;
             ( Width = pzw_8
             ; Width = pzw_16
@@ -209,6 +264,26 @@ write_value(File, Width, Value, !IO) :-
         )
     ).
 
+:- pred write_enc(io.binary_output_stream::in, value_enc::in,
+    enc_type::in, int::in, io::di, io::uo) is det.
+
+write_enc(File, with_enc, Type, NumBytes, !IO) :-
+    pz_enc_byte(Type, NumBytes, EncByte),
+    write_int8(File, EncByte, !IO).
+write_enc(_, without_enc, _, _, !IO).
+
+    % sign_extend(Bits, Num) = SignedNum
+    %
+    % Interpret the low Bits bits of Num as a signed number.  Numbers are
+    % written this way so that small negative numbers stay small.
+    %
+:- func sign_extend(int, int) = int.
+
+sign_extend(Bits, Num) = SignedNum :-
+    SignBit = 1 << (Bits - 1),
+    Mask = (1 << Bits) - 1,
+    SignedNum = ((Num /\ Mask) `xor` SignBit) - SignBit.
+
 %-----------------------------------------------------------------------%
 
 :- pred write_proc(binary_output_stream::in, pair(T, pz_proc)::in,
@@ -217,7 +292,7 @@ write_value(File, Width, Value, !IO) :-
 write_proc(File, _ - Proc, !IO) :-
     MaybeBlocks = Proc ^ pzp_blocks,
     ( MaybeBlocks = yes(Blocks),
-        write_int32(File, length(Blocks), !IO),
+        write_varint(File, length(Blocks), !IO),
         foldl(write_block(File), Blocks, !IO)
     ; MaybeBlocks = no,
         unexpected($file, $pred, "Missing definition")
@@ -229,7 +304,7 @@ write_proc(File, _ - Proc, !IO) :-
 write_block(File, pz_block(InstrObjs), !IO) :-
     filter_map((pred(pzio_instr(I)::in, I::out) is semidet),
         InstrObjs, Instrs),
-    write_int32(File, length(Instrs), !IO),
+    write_varint(File, length(Instrs), !IO),
     foldl(write_instr(File), Instrs, !IO).
 
 :- pred write_instr(binary_output_stream::in, pz_instr::in,
@@ -263,24 +338,23 @@ write_immediate(File, Immediate, !IO) :-
     ( Immediate = pz_immediate8(Int),
         write_int8(File, Int, !IO)
     ; Immediate = pz_immediate16(Int),
-        write_int16(File, Int, !IO)
-    ;
-        ( Immediate = pz_immediate32(Int)
-        ; Immediate = pz_immediate_label(Int)
-        ),
-        write_int32(File, Int, !IO)
+        write_svarint(File, sign_extend(16, Int), !IO)
+    ; Immediate = pz_immediate32(Int),
+        write_svarint(File, sign_extend(32, Int), !IO)
+    ; Immediate = pz_immediate_label(Int),
+        write_varint(File, Int, !IO)
     ; Immediate = pz_immediate64(IntHigh, IntLow),
         write_int64(File, IntHigh, IntLow, !IO)
     ; Immediate = pz_immediate_closure(ClosureId),
-        write_int32(File, pzc_id_get_num(ClosureId), !IO)
+        write_varint(File, pzc_id_get_num(ClosureId), !IO)
     ; Immediate = pz_immediate_proc(ProcId),
-        write_int32(File, pzp_id_get_num(ProcId), !IO)
+        write_varint(File, pzp_id_get_num(ProcId), !IO)
     ; Immediate = pz_immediate_import(ImportId),
-        write_int32(File, pzi_id_get_num(ImportId), !IO)
+        write_varint(File, pzi_id_get_num(ImportId), !IO)
     ; Immediate = pz_immediate_struct(SID),
-        write_int32(File, pzs_id_get_num(SID), !IO)
+        write_varint(File, pzs_id_get_num(SID), !IO)
     ; Immediate = pz_immediate_struct_field(SID, field_num(FieldNumInt)),
-        write_int32(File, pzs_id_get_num(SID), !IO),
+        write_varint(File, pzs_id_get_num(SID), !IO),
         % Subtract 1 for the zero-based encoding format.
         write_int8(File, FieldNumInt - 1, !IO)
     ).
@@ -291,8 +365,17 @@ write_immediate(File, Immediate, !IO) :-
     pair(T, pz_closure)::in, io::di, io::uo) is det.
 
 write_closure(File, _ - pz_closure(Proc, Data), !IO) :-
-    write_int32(File, pzp_id_get_num(Proc), !IO),
-    write_int32(File, pzd_id_get_num(Data), !IO).
+    write_varint(File, pzp_id_get_num(Proc), !IO),
+    write_varint(File, pzd_id_get_num(Data), !IO).
+
+%-----------------------------------------------------------------------%
+
+:- pred write_export(binary_output_stream::in,
+    pair(string, pzc_id)::in, io::di, io::uo) is det.
+
+write_export(File, Name - Closure, !IO) :-
+    write_len_string(File, Name, !IO),
+    write_varint(File, pzc_id_get_num(Closure), !IO).
 
 %-----------------------------------------------------------------------%
 %-----------------------------------------------------------------------%
@@ -68,9 +68,11 @@ parse(Filename, Result, !IO) :-
     ;       struct
     ;       data
     ;       array
+    ;       string_
     ;       closure
     ;       global_env
     ;       entry
+    ;       export
     ;       initialise_
     ;       finalise_
     ;       jmp
@@ -111,9 +113,11 @@ lexemes = [
         ("struct"           -> return(struct)),
         ("data"             -> return(data)),
         ("array"            -> return(array)),
+        ("string"           -> return(string_)),
         ("closure"          -> return(closure)),
         ("global_env"       -> return(global_env)),
         ("entry"            -> return(entry)),
+        ("export"           -> return(export)),
         ("initialise"       -> return(initialise_)),
         ("initialize"       -> return(initialise_)),
         ("finalise"         -> return(finalise_)),
@@ -166,7 +170,7 @@ ignore_tokens(comment).
 
 parse_pzt(Tokens, Result) :-
     zero_or_more_last_error(or([parse_import, parse_proc, parse_struct,
-            parse_data, parse_closure, parse_entry]),
+            parse_data, parse_closure, parse_entry, parse_export]),
         ok(Items), LastError, Tokens, EmptyTokens),
     ( EmptyTokens = [],
         Result = ok(asm(Items))
@@ -237,8 +241,8 @@ parse_data(Result, !Tokens) :-
     pzt_tokens::in, pzt_tokens::out) is det.
 
 parse_data_type(Result, !Tokens) :-
-    % Only arrays are implemented.
-    or([parse_data_type_array, parse_data_type_struct], Result, !Tokens).
+    or([parse_data_type_array, parse_data_type_string,
+        parse_data_type_struct], Result, !Tokens).
 
 :- pred parse_data_type_array(parse_res(asm_data_type)::out,
     pzt_tokens::in, pzt_tokens::out) is det.
@@ -257,6 +261,17 @@ parse_data_type_array(Result, !Tokens) :-
         Result = combine_errors_3(StartMatch, WidthResult, CloseMatch)
     ).
 
+:- pred parse_data_type_string(parse_res(asm_data_type)::out,
+    pzt_tokens::in, pzt_tokens::out) is det.
+
+parse_data_type_string(Result, !Tokens) :-
+    match_token(string_, Match, !Tokens),
+    ( Match = ok(_),
+        Result = ok(asm_dtype_string)
+    ; Match = error(C, G, E),
+        Result = error(C, G, E)
+    ).
+
 :- pred parse_data_type_struct(parse_res(asm_data_type)::out,
     pzt_tokens::in, pzt_tokens::out) is det.
 
@@ -340,6 +355,24 @@ parse_entry(Result, !Tokens) :-
         Result = combine_errors_3(MatchEntry, NameResult, MatchSemicolon)
     ).
 
+:- pred parse_export(parse_res(asm_item)::out,
+    pzt_tokens::in, pzt_tokens::out) is det.
+
+parse_export(Result, !Tokens) :-
+    get_context(!.Tokens, Context),
+    match_token(export, MatchExport, !Tokens),
+    parse_qname(NameResult, !Tokens),
+    match_token(semicolon, MatchSemicolon, !Tokens),
+    ( if
+        MatchExport = ok(_),
+        NameResult = ok(Name),
+        MatchSemicolon = ok(_)
+    then
+        Result = ok(asm_export(Context, Name))
+    else
+        Result = combine_errors_3(MatchExport, NameResult, MatchSemicolon)
+    ).
+
 %-----------------------------------------------------------------------%
 
 :- pred parse_import(parse_res(asm_item)::out,
@@ -14,6 +14,9 @@ func main() uses IO -> Int {
     test_parameter!("Squark!", 26, Stable)
     test_parameter!("heap_size", 100, Volatile)
     test_parameter!("heap_collections", 100, Volatile)
+    test_parameter!("gc_total_time_us", 100, Volatile)
+    test_parameter!("gc_max_pause_us", 100, Volatile)
+    test_parameter!("gc_p99_pause_us", 100, Volatile)
     return 0
 }
 